@@ -0,0 +1,397 @@
+/****************************************************************************
+*
+* bench_bgs.cpp
+*
+* Purpose: Throughput benchmark of every BGS algorithm. Each algorithm is
+*          run with its default parameters at several frame sizes, on 3-
+*          and, where it supports them, 1-channel frames. It is first fed
+*          the frames it needs to reach its steady state (learning phase,
+*          filled history, built eigenspace), then timed on Subtract and
+*          Update until both a minimum number of frames and a minimum time
+*          have passed. The results are written to stdout as JSON:
+*
+*              fps             frames per second
+*              ns_per_pixel    time per pixel of a frame
+*              median_ms       median time of a frame
+*              memory_bytes    heap the instance holds in its steady state
+*                              (model, masks and buffers), 0 where the C
+*                              library cannot report it
+*
+*          The frames come from a bgs::SyntheticScene with a fixed seed, so
+*          every run sees the same noise, waving texture and sprites.
+*
+******************************************************************************/
+
+#include <libBGS.h>
+#include <Simd.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace
+{
+
+struct Resolution
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+const Resolution RESOLUTIONS[] =
+{
+    { "qvga", 320, 240 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4k", 3840, 2160 }
+};
+
+// Create an instance with its default parameters on 'threads' threads and set 'warmup' to the
+// number of frames it needs before it is in its steady state.
+typedef bgs::Bgs* (*Factory)(unsigned int threads, int& warmup);
+
+bgs::Bgs* CreateGrimson(unsigned int threads, int& warmup)
+{
+    bgs::GrimsonParams params;
+    params.Threads() = threads;
+    warmup = 10;
+    return new bgs::GrimsonGMM(params);
+}
+
+bgs::Bgs* CreateZivkovic(unsigned int threads, int& warmup)
+{
+    bgs::ZivkovicParams params;
+    params.Threads() = threads;
+    warmup = 10;
+    return new bgs::ZivkovicAGMM(params);
+}
+
+bgs::Bgs* CreatePoppe(unsigned int threads, int& warmup)
+{
+    bgs::PoppeParams params;
+    params.Threads() = threads;
+    warmup = 10;
+    return new bgs::PoppeGMM(params);
+}
+
+// The default history of 100 float frames takes gigabytes at 4K, so the eigenspace is built
+// from 20 frames kept in 8 bits.
+bgs::Bgs* CreateEigenbackground(unsigned int threads, int& warmup)
+{
+    bgs::EigenbackgroundParams params;
+    params.Threads() = threads;
+    params.HistorySize() = 20;
+    params.SnapshotTraining() = true;
+    warmup = params.HistorySize() + 1;
+    return new bgs::Eigenbackground(params);
+}
+
+bgs::Bgs* CreatePrati(unsigned int threads, int& warmup)
+{
+    bgs::PratiParams params;
+    params.Threads() = threads;
+    warmup = params.HistorySize()*params.SamplingRate();
+    return new bgs::PratiMediod(params);
+}
+
+bgs::Bgs* CreateAdaptiveMedian(unsigned int threads, int& warmup)
+{
+    bgs::AdaptiveMedianParams params;
+    params.Threads() = threads;
+    warmup = params.LearningFrames();
+    return new bgs::AdaptiveMedian(params);
+}
+
+bgs::Bgs* CreateMean(unsigned int threads, int& warmup)
+{
+    bgs::MeanParams params;
+    params.Threads() = threads;
+    warmup = params.LearningFrames();
+    return new bgs::Mean(params);
+}
+
+bgs::Bgs* CreateWren(unsigned int threads, int& warmup)
+{
+    bgs::WrenParams params;
+    params.Threads() = threads;
+    warmup = params.LearningFrames();
+    return new bgs::WrenGA(params);
+}
+
+bgs::Bgs* CreateFrameDifferencing(unsigned int threads, int& warmup)
+{
+    bgs::SimpleFrameDifferencingParams params;
+    params.Threads() = threads;
+    warmup = params.Offset() + 1;
+    return new bgs::SimpleFrameDifferencing(params);
+}
+
+struct Algorithm
+{
+    const char* name;
+    Factory create;
+    bool grayscale;     // also runs on 1-channel frames
+};
+
+const Algorithm ALGORITHMS[] =
+{
+    { "GrimsonGMM", CreateGrimson, false },
+    { "ZivkovicAGMM", CreateZivkovic, false },
+    { "PoppeGMM", CreatePoppe, false },
+    { "Eigenbackground", CreateEigenbackground, true },
+    { "PratiMediod", CreatePrati, false },
+    { "AdaptiveMedian", CreateAdaptiveMedian, true },
+    { "Mean", CreateMean, true },
+    { "WrenGA", CreateWren, true },
+    { "SimpleFrameDifferencing", CreateFrameDifferencing, true }
+};
+
+struct Options
+{
+    Options() : frames(20), min_time(1.0), threads(0) {}
+
+    std::vector<std::string> algorithms;
+    std::vector<std::string> resolutions;
+    std::vector<int> channels;
+    int frames;
+    double min_time;
+    unsigned int threads;
+};
+
+struct Result
+{
+    int frames;
+    double seconds;
+    double median_ms;
+    size_t memory_bytes;
+};
+
+// frames the input cycles through
+const int INPUT_FRAMES = 8;
+
+std::vector<cv::Mat> MakeFrames(int width, int height, int channels)
+{
+    bgs::SyntheticSceneParams params;
+    params.Width() = width;
+    params.Height() = height;
+    params.Channels() = channels;
+    params.Seed() = 12345;
+    bgs::SyntheticScene scene(params);
+
+    std::vector<cv::Mat> frames(INPUT_FRAMES);
+    cv::Mat foreground_mask;
+    for(int f = 0; f < INPUT_FRAMES; ++f)
+        scene.Read(frames[f], foreground_mask);
+    return frames;
+}
+
+// heap in use by the process
+size_t HeapBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo info = mallinfo();
+    return (size_t)(unsigned int)info.uordblks + (size_t)(unsigned int)info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+Result Run(const Algorithm& algorithm, const std::vector<cv::Mat>& frames, const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const size_t heap = HeapBytes();
+
+    int warmup = 0;
+    std::unique_ptr<bgs::Bgs> bgs(algorithm.create(options.threads, warmup));
+    cv::Mat low_threshold_mask, high_threshold_mask;
+
+    size_t next = 0;
+    for(int i = 0; i < warmup; ++i)
+    {
+        const cv::Mat& frame = frames[next++ % frames.size()];
+        bgs->Subtract(frame, low_threshold_mask, high_threshold_mask);
+        bgs->Update(frame, low_threshold_mask);
+    }
+
+    std::vector<double> times;
+    double seconds = 0;
+    while((int)times.size() < options.frames || seconds < options.min_time)
+    {
+        const cv::Mat& frame = frames[next++ % frames.size()];
+
+        Clock::time_point start = Clock::now();
+        bgs->Subtract(frame, low_threshold_mask, high_threshold_mask);
+        bgs->Update(frame, low_threshold_mask);
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        times.push_back(elapsed);
+        seconds += elapsed;
+    }
+
+    Result result;
+    result.frames = (int)times.size();
+    result.seconds = seconds;
+    std::nth_element(times.begin(), times.begin() + times.size()/2, times.end());
+    result.median_ms = 1000*times[times.size()/2];
+    const size_t steady = HeapBytes();
+    result.memory_bytes = steady > heap ? steady - heap : 0;
+    return result;
+}
+
+std::vector<std::string> Split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+bool Selected(const std::vector<std::string>& selection, const std::string& name)
+{
+    return selection.empty() || std::find(selection.begin(), selection.end(), name) != selection.end();
+}
+
+void Usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --algorithms A,B    algorithms to run (default all)\n"
+              << "  --resolutions R,S   qvga, 720p, 1080p and/or 4k (default all)\n"
+              << "  --channels 1,3      channel counts to run (default both)\n"
+              << "  --frames N          minimum number of timed frames (default 20)\n"
+              << "  --min-time S        minimum timed seconds (default 1)\n"
+              << "  --threads N         threads per algorithm, 0 for all cores (default 0)\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if(i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+
+        if(option == "--algorithms")
+            options.algorithms = Split(value);
+        else if(option == "--resolutions")
+            options.resolutions = Split(value);
+        else if(option == "--channels")
+        {
+            std::vector<std::string> channels = Split(value);
+            for(size_t c = 0; c < channels.size(); ++c)
+            {
+                if(channels[c] != "1" && channels[c] != "3")
+                    return false;
+                options.channels.push_back(atoi(channels[c].c_str()));
+            }
+        }
+        else if(option == "--frames")
+            options.frames = std::max(atoi(value.c_str()), 1);
+        else if(option == "--min-time")
+            options.min_time = atof(value.c_str());
+        else if(option == "--threads")
+            options.threads = (unsigned int)std::max(atoi(value.c_str()), 0);
+        else
+            return false;
+    }
+
+    if(options.channels.empty())
+    {
+        options.channels.push_back(3);
+        options.channels.push_back(1);
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    // start the shared pool before any heap is measured
+    bgs::ThreadPool& pool = bgs::ThreadPool::Instance();
+
+    printf("{\n");
+    printf("  \"pool_threads\": %u,\n", pool.Threads());
+    printf("  \"threads\": %u,\n", options.threads);
+    printf("  \"simd\": \"%s\",\n", bgs::simd::Level());
+    printf("  \"min_frames\": %d,\n", options.frames);
+    printf("  \"min_time\": %g,\n", options.min_time);
+    printf("  \"results\": [");
+
+    bool first = true;
+    bool failed = false;
+    for(size_t r = 0; r < sizeof(RESOLUTIONS)/sizeof(RESOLUTIONS[0]); ++r)
+    {
+        const Resolution& resolution = RESOLUTIONS[r];
+        if(!Selected(options.resolutions, resolution.name))
+            continue;
+
+        for(size_t c = 0; c < options.channels.size(); ++c)
+        {
+            const int channels = options.channels[c];
+            std::vector<cv::Mat> frames = MakeFrames(resolution.width, resolution.height, channels);
+
+            for(size_t a = 0; a < sizeof(ALGORITHMS)/sizeof(ALGORITHMS[0]); ++a)
+            {
+                const Algorithm& algorithm = ALGORITHMS[a];
+                if(!Selected(options.algorithms, algorithm.name) || (channels == 1 && !algorithm.grayscale))
+                    continue;
+
+                std::cerr << algorithm.name << " " << resolution.name << " " << channels << " channel(s)" << std::endl;
+
+                Result result;
+                try
+                {
+                    result = Run(algorithm, frames, options);
+                }
+                catch(const std::exception& e)
+                {
+                    std::cerr << "  failed: " << e.what() << std::endl;
+                    failed = true;
+                    continue;
+                }
+
+                const double pixels = (double)resolution.width*resolution.height;
+                printf("%s\n    {\"algorithm\": \"%s\", \"resolution\": \"%s\", \"width\": %d, \"height\": %d, "
+                       "\"channels\": %d, \"frames\": %d, \"fps\": %.3f, \"ns_per_pixel\": %.4f, "
+                       "\"median_ms\": %.4f, \"memory_bytes\": %zu}",
+                       first ? "" : ",", algorithm.name, resolution.name, resolution.width, resolution.height,
+                       channels, result.frames, result.frames/result.seconds,
+                       1e9*result.seconds/(result.frames*pixels), result.median_ms, result.memory_bytes);
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+
+    printf("\n  ]\n}\n");
+    return failed ? 1 : 0;
+}
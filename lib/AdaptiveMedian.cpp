@@ -1,4 +1,5 @@
 #include "AdaptiveMedian.hpp"
+#include "Simd.hpp"
 
 using namespace bgs;
 
@@ -39,6 +40,84 @@ void AdaptiveMedian::Load(std::string file)
 
 }
 
+namespace
+{
+
+// A threshold t as a byte k, so that an 8-bit difference d is above t exactly when d > k
+// or 'always' is set.
+template<class V>
+struct ByteThreshold
+{
+    ByteThreshold(float t)
+    {
+        k = V::set1(t >= 255 ? 255 : (t < 0 ? 0 : (unsigned char)t));
+        always = V::set1(t < 0 ? 0xff : 0);
+    }
+
+    V Above(const V& d) const { return (d > k) | always; }
+
+    V k;
+    V always;
+};
+
+// Masks of the pixels whose largest difference to the median over the channels is above
+// each threshold. FOREGROUND is 255, so the comparisons are stored as they are.
+template<class V, int CHANNELS>
+void SubtractPixels(const unsigned char* pixels, const unsigned char* median, unsigned char* low,
+                    unsigned char* high, const ByteThreshold<V>& low_threshold, const ByteThreshold<V>& high_threshold)
+{
+    V d;
+    if(CHANNELS == 3)
+    {
+        V d0 = v_absdiff(V::load(pixels), V::load(median));
+        V d1 = v_absdiff(V::load(pixels + V::WIDTH), V::load(median + V::WIDTH));
+        V d2 = v_absdiff(V::load(pixels + 2*V::WIDTH), V::load(median + 2*V::WIDTH));
+        V x, y, z;
+        v_deinterleave3(d0, d1, d2, x, y, z);
+        d = v_max(x, v_max(y, z));
+    }
+    else
+    {
+        d = v_absdiff(V::load(pixels), V::load(median));
+    }
+
+    V::store(low, low_threshold.Above(d));
+    V::store(high, high_threshold.Above(d));
+}
+
+// move each value of the median one step towards the image where 'update' is set
+template<class V>
+V Step(const V& pixel, const V& median, const V& update)
+{
+    const V one = V::set1(1);
+    return median + ((pixel > median) & update & one) - ((median > pixel) & update & one);
+}
+
+template<class V, int CHANNELS>
+void UpdatePixels(const unsigned char* pixels, unsigned char* median, const unsigned char* mask, const V& learning)
+{
+    V update = (V::load(mask) == V::set1(Bgs::BACKGROUND)) | learning;
+    if(!v_any(update))
+        return;
+
+    if(CHANNELS == 3)
+    {
+        V u[3];
+        v_interleave3(update, update, update, u[0], u[1], u[2]);
+        for(int i = 0; i < 3; ++i)
+        {
+            const int offset = i*V::WIDTH;
+            V::store(median + offset, Step(V::load(pixels + offset), V::load(median + offset), u[i]));
+        }
+    }
+    else
+    {
+        V::store(median, Step(V::load(pixels), V::load(median), update));
+    }
+}
+
+}
+
 void AdaptiveMedian::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
     if(m_frame_num == 0)
@@ -50,24 +129,17 @@ void AdaptiveMedian::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask,
     if(high_threshold_mask.empty())
         high_threshold_mask.create(m_params.Height(), m_params.Width(), CV_8U);
 
-    unsigned char low_threshold, high_threshold;
-
-    // update each pixel of the image
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    // compare each pixel of the image with the median, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // perform background subtraction
             if(m_params.Channels() == 3)
-                SubtractPixel(r, c, image.at<cv::Vec3b>(r,c), low_threshold, high_threshold);
+                SubtractRow<3>(r, image, low_threshold_mask, high_threshold_mask);
             else
-                SubtractPixel(r, c, image.at<unsigned char>(r,c), low_threshold, high_threshold);
-
-            // setup silhouette mask
-            low_threshold_mask.at<unsigned char>(r,c) = low_threshold;
-            high_threshold_mask.at<unsigned char>(r,c) = high_threshold;
+                SubtractRow<1>(r, image, low_threshold_mask, high_threshold_mask);
         }
-    }
+    });
 
     m_frame_num++;
 }
@@ -76,83 +148,62 @@ void AdaptiveMedian::Update(const cv::Mat& image,  const cv::Mat& update_mask)
 {
     if(m_frame_num % m_params.SamplingRate() == 1)
     {
-        // update background model
-        for (unsigned int r = 0; r < m_params.Height(); ++r)
+        // perform conditional updating only if we are passed the learning phase
+        const bool learning = m_frame_num < m_params.LearningFrames();
+
+        // update background model, a band of rows at a time
+        ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
         {
-            for(unsigned int c = 0; c < m_params.Width(); ++c)
+            for(int r = row_begin; r < row_end; ++r)
             {
-                // perform conditional updating only if we are passed the learning phase
-                if(update_mask.at<unsigned char>(r,c) == BACKGROUND || m_frame_num < m_params.LearningFrames())
-                {
-                    if(m_params.Channels() == 3)
-                    {
-                        for(int ch = 0; ch < 3; ++ch)
-                        {
-                            if(image.at<cv::Vec3b>(r,c)[ch] > m_median.at<cv::Vec3b>(r,c)[ch])
-                            {
-                                m_median.at<cv::Vec3b>(r,c)[ch]++;
-                            }
-                            else if(image.at<cv::Vec3b>(r,c)[ch] < m_median.at<cv::Vec3b>(r,c)[ch])
-                            {
-                                m_median.at<cv::Vec3b>(r,c)[ch]--;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        if(image.at<unsigned char>(r,c) > m_median.at<unsigned char>(r,c))
-                        {
-                            m_median.at<unsigned char>(r,c)++;
-                        }
-                        else if(image.at<unsigned char>(r,c) < m_median.at<unsigned char>(r,c))
-                        {
-                            m_median.at<unsigned char>(r,c)--;
-                        }
-                    }
-
-                }
+                if(m_params.Channels() == 3)
+                    UpdateRow<3>(r, image, update_mask, learning);
+                else
+                    UpdateRow<1>(r, image, update_mask, learning);
             }
-        }
+        });
     }
 }
 
-void AdaptiveMedian::SubtractPixel(int r, int c, const cv::Vec3b pixel, unsigned char& low_threshold, unsigned char& high_threshold)
+template<int CHANNELS>
+void AdaptiveMedian::SubtractRow(int r, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
-    // perform background subtraction
-    low_threshold = high_threshold = FOREGROUND;
-
-    int diffR = abs(pixel[0] - m_median.at<cv::Vec3b>(r,c)[0]);
-    int diffG = abs(pixel[1] - m_median.at<cv::Vec3b>(r,c)[1]);
-    int diffB = abs(pixel[2] - m_median.at<cv::Vec3b>(r,c)[2]);
-
-    if(diffR <= m_params.LowThreshold() && diffG <= m_params.LowThreshold() &&  diffB <= m_params.LowThreshold())
-    {
-        low_threshold = BACKGROUND;
-    }
-
-    if(diffR <= m_params.HighThreshold() && diffG <= m_params.HighThreshold() &&  diffB <= m_params.HighThreshold())
-    {
-        high_threshold = BACKGROUND;
-    }
+    typedef simd::VU8 V;
+    typedef simd::VU8x1 V1;
+
+    const ByteThreshold<V> low(m_params.LowThreshold()), high(m_params.HighThreshold());
+    const ByteThreshold<V1> low1(m_params.LowThreshold()), high1(m_params.HighThreshold());
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    const unsigned char* median = m_median.ptr<unsigned char>(r);
+    unsigned char* lowMask = low_threshold_mask.ptr<unsigned char>(r);
+    unsigned char* highMask = high_threshold_mask.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        SubtractPixels<V, CHANNELS>(pixels + CHANNELS*c, median + CHANNELS*c, lowMask + c, highMask + c, low, high);
+    for(; c < width; ++c)
+        SubtractPixels<V1, CHANNELS>(pixels + CHANNELS*c, median + CHANNELS*c, lowMask + c, highMask + c, low1, high1);
 }
 
-void AdaptiveMedian::SubtractPixel(int r, int c, const unsigned char pixel, unsigned char& low_threshold, unsigned char& high_threshold)
+template<int CHANNELS>
+void AdaptiveMedian::UpdateRow(int r, const cv::Mat& image, const cv::Mat& update_mask, bool learning)
 {
-    // perform background subtraction
-    low_threshold = high_threshold = FOREGROUND;
-
-    int diff = abs(pixel - m_median.at<unsigned char>(r,c));
-
-    if(diff <= m_params.LowThreshold())
-    {
-        low_threshold = BACKGROUND;
-    }
-
-    if(diff <= m_params.HighThreshold())
-    {
-        high_threshold = BACKGROUND;
-    }
+    typedef simd::VU8 V;
+    typedef simd::VU8x1 V1;
+
+    const V all = V::set1(learning ? 0xff : 0);
+    const V1 all1 = V1::set1(learning ? 0xff : 0);
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    const unsigned char* mask = update_mask.ptr<unsigned char>(r);
+    unsigned char* median = m_median.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        UpdatePixels<V, CHANNELS>(pixels + CHANNELS*c, median + CHANNELS*c, mask + c, all);
+    for(; c < width; ++c)
+        UpdatePixels<V1, CHANNELS>(pixels + CHANNELS*c, median + CHANNELS*c, mask + c, all1);
 }
-
-
-
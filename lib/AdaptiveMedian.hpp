@@ -67,8 +67,12 @@ public:
 
 private:
     void Initalize(const cv::Mat& image);
-    void SubtractPixel(int r, int c, const cv::Vec3b pixel, unsigned char& low_threshold, unsigned char& high_threshold);
-    void SubtractPixel(int r, int c, const unsigned char pixel, unsigned char& low_threshold, unsigned char& high_threshold);
+
+    template<int CHANNELS>
+    void SubtractRow(int r, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
+
+    template<int CHANNELS>
+    void UpdateRow(int r, const cv::Mat& image, const cv::Mat& update_mask, bool learning);
 
     AdaptiveMedianParams m_params;
     cv::Mat m_median;
@@ -21,6 +21,7 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "BgsParams.hpp"
+#include "ThreadPool.hpp"
 
 namespace bgs
 {
@@ -50,6 +51,13 @@ public:
 protected:
     virtual void Initalize(const cv::Mat& image) = 0;
 
+    // Run body over bands of rows on the shared thread pool, see bgs::ParallelRows().
+    template<class Body>
+    void ParallelRows(int rows, unsigned int threads, const Body& body)
+    {
+        bgs::ParallelRows(rows, threads, body);
+    }
+
     int m_frame_num;
 };
 
@@ -21,6 +21,7 @@ namespace bgs
 class BgsParams
 {
 public:
+    BgsParams() : m_threads(0) {}
     virtual ~BgsParams() {}
 
     virtual void SetFrameSize(unsigned int width, unsigned int height)
@@ -38,6 +39,9 @@ public:
     float &LowThreshold() { return m_low_threshold; }
     float &HighThreshold() { return m_high_threshold; }
 
+    // Number of threads Subtract() and Update() may use, 0 for all cores and 1 to run serially.
+    unsigned int &Threads() { return m_threads; }
+
     virtual void write(cv::FileStorage& fs) const = 0; // write serialization
     virtual void read(const cv::FileNode& node) = 0; // read serialization
 
@@ -48,6 +52,7 @@ protected:
     unsigned int m_channels;
     float m_low_threshold;
     float m_high_threshold;
+    unsigned int m_threads;
 };
 
 }
@@ -0,0 +1,101 @@
+#include "BgsStreamGroup.hpp"
+
+#include <functional>
+
+using namespace bgs;
+
+BgsStreamGroup::BgsStreamGroup()
+{
+    m_next_id = 0;
+    m_batch = 0;
+}
+
+BgsStreamGroup::~BgsStreamGroup()
+{
+
+}
+
+int BgsStreamGroup::Add(Bgs* bgs)
+{
+    if(!bgs)
+        CV_Error( CV_StsNullPtr, "BgsStreamGroup::Add() needs an algorithm instance" );
+
+    std::unique_ptr<StreamState> state(new StreamState());
+    state->bgs.reset(bgs);
+    state->batch = -1;
+
+    int id = m_next_id++;
+    m_streams[id] = std::move(state);
+    return id;
+}
+
+void BgsStreamGroup::Remove(int stream)
+{
+    State(stream);
+    m_streams.erase(stream);
+}
+
+BgsStreamGroup::StreamState& BgsStreamGroup::State(int stream)
+{
+    std::map<int, std::unique_ptr<StreamState> >::iterator it = m_streams.find(stream);
+    if(it == m_streams.end())
+        CV_Error( CV_StsBadArg, "Unknown stream id" );
+    return *it->second;
+}
+
+const BgsStreamGroup::StreamState& BgsStreamGroup::State(int stream) const
+{
+    std::map<int, std::unique_ptr<StreamState> >::const_iterator it = m_streams.find(stream);
+    if(it == m_streams.end())
+        CV_Error( CV_StsBadArg, "Unknown stream id" );
+    return *it->second;
+}
+
+Bgs& BgsStreamGroup::Stream(int stream)
+{
+    return *State(stream).bgs;
+}
+
+const cv::Mat& BgsStreamGroup::LowThresholdMask(int stream) const
+{
+    return State(stream).low_threshold_mask;
+}
+
+const cv::Mat& BgsStreamGroup::HighThresholdMask(int stream) const
+{
+    return State(stream).high_threshold_mask;
+}
+
+void BgsStreamGroup::Process(const std::vector<Frame>& frames)
+{
+    const int batch = m_batch++;
+
+    // look the streams up before any work starts, so a bad batch changes no model
+    std::vector<std::pair<size_t, int> > order;
+    std::vector<StreamState*> states(frames.size());
+    for(size_t i = 0; i < frames.size(); ++i)
+    {
+        StreamState& state = State(frames[i].stream);
+        if(state.batch == batch)
+            CV_Error( CV_StsBadArg, "A stream can only have one frame per batch" );
+        state.batch = batch;
+        states[i] = &state;
+        order.push_back(std::make_pair(frames[i].image.total()*frames[i].image.elemSize(), (int)i));
+    }
+
+    // largest frames first, so the small ones fill in around them at the end
+    std::sort(order.begin(), order.end(), std::greater<std::pair<size_t, int> >());
+
+    // one range per stream; the rows of each frame are split again inside Subtract/Update
+    ThreadPool::Instance().ParallelFor(0, (int)order.size(), 1, [&](int begin, int end)
+    {
+        for(int k = begin; k < end; ++k)
+        {
+            const int i = order[k].second;
+            StreamState& state = *states[i];
+
+            state.bgs->Subtract(frames[i].image, state.low_threshold_mask, state.high_threshold_mask);
+            state.bgs->Update(frames[i].image, state.low_threshold_mask);
+        }
+    });
+}
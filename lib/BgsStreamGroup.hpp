@@ -0,0 +1,82 @@
+/****************************************************************************
+*
+* BgsStreamGroup.hpp
+*
+* Purpose: Runs the background models of many video streams, such as the
+*          cameras handled by one server, as a group. Frames are handed in
+*          as a batch keyed by stream and the streams are processed at the
+*          same time on the shared thread pool, the largest frames first.
+*          The bands of rows each algorithm splits its frame into go onto
+*          the same work-stealing deques, so idle threads pick up the rows
+*          of a large stream instead of the machine being oversubscribed
+*          by a pool per stream.
+*
+******************************************************************************/
+
+#ifndef BGS_STREAM_GROUP_H_
+#define BGS_STREAM_GROUP_H_
+
+#include "Bgs.hpp"
+
+#include <map>
+#include <memory>
+
+namespace bgs
+{
+
+class BgsStreamGroup
+{
+public:
+    // a frame of one stream in a batch
+    struct Frame
+    {
+        Frame() : stream(-1) {}
+        Frame(int s, const cv::Mat& i) : stream(s), image(i) {}
+
+        int stream;
+        cv::Mat image;
+    };
+
+    BgsStreamGroup();
+    ~BgsStreamGroup();
+
+    // Take ownership of an algorithm instance and return the id of its stream. The streams
+    // can use different algorithms and frame sizes.
+    int Add(Bgs* bgs);
+    void Remove(int stream);
+
+    int Streams() const { return (int)m_streams.size(); }
+    Bgs& Stream(int stream);
+
+    // Subtract each frame from the model of its stream and update the model with the low
+    // threshold mask, all streams in parallel. A stream may appear once per batch.
+    void Process(const std::vector<Frame>& frames);
+
+    // masks of the last frame processed for a stream
+    const cv::Mat& LowThresholdMask(int stream) const;
+    const cv::Mat& HighThresholdMask(int stream) const;
+
+private:
+    struct StreamState
+    {
+        std::unique_ptr<Bgs> bgs;
+        cv::Mat low_threshold_mask;
+        cv::Mat high_threshold_mask;
+        // batch the stream was last seen in, to catch a stream given twice
+        int batch;
+    };
+
+    BgsStreamGroup(const BgsStreamGroup&);
+    BgsStreamGroup& operator=(const BgsStreamGroup&);
+
+    StreamState& State(int stream);
+    const StreamState& State(int stream) const;
+
+    std::map<int, std::unique_ptr<StreamState> > m_streams;
+    int m_next_id;
+    int m_batch;
+};
+
+}
+
+#endif
@@ -1,22 +1,83 @@
 #include "Eigenbackground.hpp"
+#include "Simd.hpp"
+
+#include <limits.h>
+#include <string.h>
 
 using namespace bgs;
 
+namespace
+{
+
+// Header of the binary model file. It is followed by the mean, the eigenvalues and the
+// eigenvectors as CV_32F and the background with the type of the frames, each block starting
+// on a ModelWriter::ALIGNMENT boundary. The checksum covers everything after the header.
+struct BinaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t history_size;
+    int32_t embedded_dim;
+    int32_t precision;
+    float low_threshold;
+    float high_threshold;
+    float retained_var;
+
+    // number of eigenvectors
+    int32_t dims;
+
+    // offsets of the blocks from the start of the file
+    uint64_t mean;
+    uint64_t eigenvalues;
+    uint64_t eigenvectors;
+    uint64_t background;
+
+    uint64_t file_bytes;
+    uint64_t checksum;
+};
+
+const char BINARY_MAGIC[8] = { 'B', 'G', 'S', 'E', 'I', 'G', 'E', 'N' };
+const uint32_t BINARY_VERSION = 1;
+
+// true if a block of 'bytes' at 'offset' lies after the header and within the file, without
+// adding the two so nothing can wrap around
+bool BlockInFile(uint64_t offset, uint64_t bytes, uint64_t first, uint64_t file_bytes)
+{
+    return offset >= first && offset <= file_bytes && bytes <= file_bytes - offset;
+}
+
+bool IsBinaryName(const std::string& file)
+{
+    const std::string extension = ".bin";
+    return file.size() >= extension.size() &&
+           file.compare(file.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+}
+
 Eigenbackground::Eigenbackground()
 {
     m_params = EigenbackgroundParams();
     m_frame_num = 0;
+    m_rebuild_done = false;
 }
 
 Eigenbackground::Eigenbackground(const BgsParams &p)
 {
     m_params = (EigenbackgroundParams&)p;
     m_frame_num = 0;
+    m_rebuild_done = false;
 }
 
 Eigenbackground::~Eigenbackground()
 {
-
+    if(m_rebuild.joinable())
+        m_rebuild.join();
 }
 
 void Eigenbackground::Initalize(const cv::Mat& image)
@@ -29,11 +90,19 @@ void Eigenbackground::Initalize(const cv::Mat& image)
 
     m_pca = cv::PCA();
 
+    ResetHistory();
+
     m_background = cv::Mat::zeros(m_params.Height(), m_params.Width(), image.type());
 }
 
 void Eigenbackground::Save(std::string file)
 {
+    if(IsBinaryName(file))
+    {
+        SaveBinary(file);
+        return;
+    }
+
     cv::FileStorage fs;
     fs.open(file, cv::FileStorage::WRITE);
 
@@ -76,6 +145,15 @@ void Eigenbackground::Load(std::string file)
     // changing this load method will have implications for
     // the automated testing routines in testBGS branch bpca_paper
 
+    // a rebuild still running is superseded by the loaded eigenspace
+    if(m_rebuild.joinable())
+        m_rebuild.join();
+    m_rebuild_done = false;
+    m_rebuild_error = std::exception_ptr();
+
+    if(LoadBinary(file))
+        return;
+
     cv::FileStorage fs;
     fs.open(file, cv::FileStorage::READ);
 
@@ -130,13 +208,123 @@ void Eigenbackground::Load(std::string file)
     m_pca.mean = mean;
     m_pca.eigenvalues = eigenvalues;
     m_pca.eigenvectors = eigenvectors;
+    UseEigenspace();
 
     fs["m_background"] >> m_background;
+    m_model_file.reset();
 
     fs.release();
 
+    ResetHistory();
+
+    m_frame_num = m_params.HistorySize(); // dont retrain
+    m_frame_num++;
+}
+
+// The eigenspace is stored as float, which is what frames are projected on.
+void Eigenbackground::SaveBinary(const std::string& file)
+{
+    cv::Mat mean, eigenvalues, eigenvectors;
+    m_pca.mean.convertTo(mean, CV_32F);
+    m_pca.eigenvalues.convertTo(eigenvalues, CV_32F);
+    m_pca.eigenvectors.convertTo(eigenvectors, CV_32F);
+    cv::Mat background = m_background.isContinuous() ? m_background : m_background.clone();
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.header_bytes = sizeof(header);
+    header.width = m_params.Width();
+    header.height = m_params.Height();
+    header.channels = m_params.Channels();
+    header.history_size = m_params.HistorySize();
+    header.embedded_dim = m_params.EmbeddedDim();
+    header.precision = m_params.Precision();
+    header.low_threshold = m_params.LowThreshold();
+    header.high_threshold = m_params.HighThreshold();
+    header.retained_var = m_params.RetainedVar();
+    header.dims = eigenvectors.rows;
+
+    ModelWriter writer;
+    if(!writer.Open(file, sizeof(header)))
+        CV_Error(CV_StsError, "Could not create " + file);
+
+    header.mean = writer.Write(mean.data, mean.total()*mean.elemSize());
+    header.eigenvalues = writer.Write(eigenvalues.data, eigenvalues.total()*eigenvalues.elemSize());
+    header.eigenvectors = writer.Write(eigenvectors.data, eigenvectors.total()*eigenvectors.elemSize());
+    header.background = writer.Write(background.data, background.total()*background.elemSize());
+    header.file_bytes = writer.Bytes();
+    header.checksum = writer.Checksum();
+
+    if(!writer.Close(&header, sizeof(header)))
+        CV_Error(CV_StsError, "Could not write " + file);
+}
+
+// Map a binary model file and use its blocks in place. Returns false if 'file' is not one.
+bool Eigenbackground::LoadBinary(const std::string& file)
+{
+    std::shared_ptr<MappedFile> model(new MappedFile());
+    if(!model->Open(file) || model->Size() < sizeof(BinaryHeader) ||
+       memcmp(model->Data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0)
+        return false;
+
+    unsigned char* data = model->Data();
+    BinaryHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    if(header.version != BINARY_VERSION || header.header_bytes != sizeof(header))
+        CV_Error(CV_StsUnsupportedFormat, "Unsupported version of the Eigenbackground model file " + file);
+
+    const uint64_t file_bytes = model->Size();
+    const uint64_t floats = sizeof(float);
+    const uint64_t first = (sizeof(header) + ModelWriter::ALIGNMENT - 1) / ModelWriter::ALIGNMENT * ModelWriter::ALIGNMENT;
+    if(header.file_bytes != file_bytes || header.width <= 0 || header.height <= 0 ||
+       (header.channels != 1 && header.channels != 3) || header.dims < 0)
+        CV_Error(CV_StsParseError, "Truncated or damaged Eigenbackground model file " + file);
+
+    // each factor is below 2^31, so the product of all three cannot wrap; the sizes of the
+    // blocks are only formed once they are known to fit in an int and in the file
+    const uint64_t values = (uint64_t)header.width*header.height*header.channels;
+    const uint64_t max_values = std::min<uint64_t>(INT_MAX, file_bytes) / floats;
+    const uint64_t dims = (uint64_t)header.dims;
+    if(values > max_values || dims > values || dims > max_values / values ||
+       !BlockInFile(header.mean, values*floats, first, file_bytes) ||
+       !BlockInFile(header.eigenvalues, dims*floats, first, file_bytes) ||
+       !BlockInFile(header.eigenvectors, dims*values*floats, first, file_bytes) ||
+       !BlockInFile(header.background, values, first, file_bytes))
+        CV_Error(CV_StsParseError, "Truncated or damaged Eigenbackground model file " + file);
+
+    ModelChecksum checksum;
+    checksum.Add(data + first, header.file_bytes - first);
+    if(checksum.Value() != header.checksum)
+        CV_Error(CV_StsParseError, "Checksum mismatch in the Eigenbackground model file " + file);
+
+    m_params.SetFrameSize(header.width, header.height);
+    m_params.Channels() = header.channels;
+    m_params.LowThreshold() = header.low_threshold;
+    m_params.HighThreshold() = header.high_threshold;
+    m_params.HistorySize() = header.history_size;
+    m_params.EmbeddedDim() = header.embedded_dim;
+    m_params.RetainedVar() = header.retained_var;
+    m_params.Precision() = header.precision;
+
+    m_pca = cv::PCA();
+    m_pca.mean = cv::Mat(1, (int)values, CV_32F, data + header.mean);
+    m_pca.eigenvalues = cv::Mat(header.dims, 1, CV_32F, data + header.eigenvalues);
+    m_pca.eigenvectors = cv::Mat(header.dims, (int)values, CV_32F, data + header.eigenvectors);
+    UseEigenspace();
+
+    m_background = cv::Mat(header.height, header.width, CV_8UC(header.channels), data + header.background);
+
+    // the mats above point into the file, which stays mapped until the next Load()
+    m_model_file = model;
+
+    ResetHistory();
+
     m_frame_num = m_params.HistorySize(); // dont retrain
     m_frame_num++;
+    return true;
 }
 
 void Eigenbackground::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
@@ -150,115 +338,306 @@ void Eigenbackground::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask
     if(high_threshold_mask.empty())
         high_threshold_mask.create(m_params.Height(), m_params.Width(), CV_8U);
 
+    // an eigenspace built in the background replaces the current one between frames
+    if(m_rebuild_done)
+        FinishRebuild();
+
     // create eigenbackground
-    if(m_frame_num == m_params.HistorySize())
+    if(RebuildDue())
     {
         //std::cout << "==" << std::endl;
 
-        // create the eigenspace
-        if(m_params.EmbeddedDim() == 0)
+        if(m_params.AsyncRebuild())
         {
-            m_pca = cv::PCA(m_pcaImages, cv::Mat(), CV_PCA_DATA_AS_ROW, m_params.RetainedVar());
+            StartRebuild();
         }
         else
-            m_pca = cv::PCA(m_pcaImages, cv::Mat(), CV_PCA_DATA_AS_ROW, m_params.EmbeddedDim());
-
-        m_background = norm_0_255(m_pca.mean.reshape(m_background.channels(), m_params.Height()));
+        {
+            ComputeEigenspace(m_params, m_pcaImages, m_history, m_params.Threads(), m_pca);
+            UseEigenspace();
+            m_background = norm_0_255(m_pca.mean.reshape(m_background.channels(), m_params.Height()));
+        }
 
         // free the image
         //m_pcaImages.release();
     }
 
-    if(m_frame_num >= m_params.HistorySize())
+    // frames after the first HistorySize() are only kept for rebuilds
+    const bool keepFrame = m_frame_num < m_params.HistorySize() || m_params.RebuildInterval() > 0;
+
+    if(m_frame_num >= m_params.HistorySize() && !m_basis.empty())
     {
         //std::cout << ">=" << std::endl;
 
-        // project new image into the eigenspace
-        cv::Mat image_row = image.clone().reshape(1,1);
-        cv::Mat point = m_pca.project(image_row);
+        // project new image into the eigenspace, then compare it with its reconstruction
+        Project(&image, 1);
+        Threshold(&image, 1, &low_threshold_mask, &high_threshold_mask);
+
+        if(keepFrame)
+            UpdateHistory(image);
+    }
+    else
+    {
+        //std::cout << "else" << std::endl;
 
-        // reconstruct point
-        cv::Mat reconstruction = m_pca.backProject(point);
+        if(keepFrame)
+            UpdateHistory(image);
 
-        // calculate Euclidean distance between new image and its eigenspace projection
-        int index = 0;
-        for(unsigned int r = 0; r < m_params.Height(); ++r)
+        // set entire image to background since there is not enough information yet
+        // to start performing background subtraction
+        ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
         {
-            for(unsigned int c = 0; c < m_params.Width(); ++c)
+            for(int r = row_begin; r < row_end; ++r)
             {
-                double dist = 0;
-                bool bgLow = true;
-                bool bgHigh = true;
-
-                if(m_params.Channels() == 3)
+                for(unsigned int c = 0; c < m_params.Width(); ++c)
                 {
-                    for(int ch = 0; ch < m_background.channels(); ++ch)
-                    {
-                        if(m_params.Precision() == 1)
-                            dist = abs(image.at<cv::Vec3b>(r,c)[ch] - reconstruction.at<float>(0,index));
-                        else
-                            dist = abs(image.at<cv::Vec3b>(r,c)[ch] - reconstruction.at<double>(0,index));
-
-                        if(dist > m_params.LowThreshold())
-                            bgLow = false;
-                        if(dist > m_params.HighThreshold())
-                            bgHigh = false;
-                        index++;
-                    }
+                    low_threshold_mask.at<unsigned char>(r,c) = BACKGROUND;
+                    high_threshold_mask.at<unsigned char>(r,c) = BACKGROUND;
                 }
-                else
-                {
-                    if(m_params.Precision() == 1)
-                        dist = abs(image.at<unsigned char>(r,c) - reconstruction.at<float>(0,index));
-                    else
-                        dist = abs(image.at<unsigned char>(r,c) - reconstruction.at<double>(0,index));
+            }
+        });
+    }
 
-                    if(dist > m_params.LowThreshold())
-                        bgLow = false;
-                    if(dist > m_params.HighThreshold())
-                        bgHigh = false;
-                    index++;
-                }
+    m_frame_num++;
+}
+
+// The frames are projected on a float copy of the eigenspace, which halves the memory
+// traffic of a double one. A float eigenspace is shared rather than copied.
+void Eigenbackground::UseEigenspace()
+{
+    if(m_pca.eigenvectors.depth() == CV_32F)
+    {
+        m_basis = m_pca.eigenvectors;
+        m_basis_mean = m_pca.mean;
+    }
+    else
+    {
+        m_pca.eigenvectors.convertTo(m_basis, CV_32F);
+        m_pca.mean.convertTo(m_basis_mean, CV_32F);
+    }
+
+    m_partial.resize((size_t)m_params.Height()*m_basis.rows);
+}
+
+namespace
+{
+
+// Values of a row handled at a time by the projection and reconstruction. A whole number
+// of pixels for one and three channels and of vectors, small enough that the values of a
+// batch of frames stay in cache while each eigenvector is applied to all of them.
+const int CHUNK = 768;
+
+// out[f] = x[f].e for FRAMES frames, sharing the loads of e. Each frame is summed in the same
+// order whatever FRAMES is, so a frame gets the same coefficients in any batch.
+template<int FRAMES>
+void DotFrames(const float* e, const float* const* x, int n, float* out)
+{
+    typedef simd::VFloat V;
+
+    V sum[FRAMES];
+    for(int f = 0; f < FRAMES; ++f)
+        sum[f] = V::zero();
+
+    int i = 0;
+    for(; i + V::WIDTH <= n; i += V::WIDTH)
+    {
+        const V ev = V::load(e+i);
+        for(int f = 0; f < FRAMES; ++f)
+            sum[f] = sum[f] + ev*V::load(x[f]+i);
+    }
+
+    for(int f = 0; f < FRAMES; ++f)
+    {
+        float lanes[V::WIDTH];
+        V::store(lanes, sum[f]);
+        float result = 0;
+        for(int l = 0; l < V::WIDTH; ++l)
+            result += lanes[l];
+        for(int j = i; j < n; ++j)
+            result += x[f][j]*e[j];
+        out[f] = result;
+    }
+}
+
+// y += a*x
+void Axpy(float* y, float a, const float* x, int n)
+{
+    typedef simd::VFloat V;
+
+    const V va = V::set1(a);
+    int i = 0;
+    for(; i + V::WIDTH <= n; i += V::WIDTH)
+        V::store(y+i, V::load(y+i) + va*V::load(x+i));
+    for(; i < n; ++i)
+        y[i] += a*x[i];
+}
+
+}
+
+// Coefficients of the frames in the eigenspace, e_k.(x - mean) for each eigenvector, one row
+// of m_coefficients per frame. A chunk of a row of every frame is centred and then taken
+// against all the eigenvectors, so for a batch this is one matrix product that reads each
+// eigenvector once rather than once per frame. The sums of the rows are added up in order
+// so the result depends neither on the threads nor on the batch.
+void Eigenbackground::Project(const cv::Mat* images, int count)
+{
+    typedef simd::VFloat V;
+
+    const int rows = m_params.Height();
+    const int row_len = m_params.Width()*m_params.Channels();
+    const int dims = m_basis.rows;
+
+    m_partial.assign((size_t)rows*count*dims, 0.0);
+
+    ParallelRows(rows, m_params.Threads(), [&](int row_begin, int row_end)
+    {
+        std::vector<float> centred((size_t)count*CHUNK);
+        std::vector<const float*> frames(count);
+        std::vector<float> dot(count);
+        for(int f = 0; f < count; ++f)
+            frames[f] = &centred[(size_t)f*CHUNK];
 
-                if(!bgLow)
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const long pos = (long)r*row_len;
+            double* partial = &m_partial[(size_t)r*count*dims];
+
+            for(int begin = 0; begin < row_len; begin += CHUNK)
+            {
+                const int len = std::min(CHUNK, row_len - begin);
+                const float* mean = m_basis_mean.ptr<float>() + pos + begin;
+
+                for(int f = 0; f < count; ++f)
                 {
-                    low_threshold_mask.at<unsigned char>(r,c) = FOREGROUND;
+                    const unsigned char* pixels = images[f].ptr<unsigned char>(r) + begin;
+                    float* x = &centred[(size_t)f*CHUNK];
+                    int i = 0;
+                    for(; i + V::WIDTH <= len; i += V::WIDTH)
+                        V::store(x+i, V::load_u8(pixels+i) - V::load(mean+i));
+                    for(; i < len; ++i)
+                        x[i] = pixels[i] - mean[i];
                 }
-                else
+
+                for(int k = 0; k < dims; ++k)
                 {
-                    low_threshold_mask.at<unsigned char>(r,c) = BACKGROUND;
+                    const float* e = m_basis.ptr<float>(k) + pos + begin;
+                    int f = 0;
+                    for(; f + 4 <= count; f += 4)
+                        DotFrames<4>(e, &frames[f], len, &dot[f]);
+                    for(; f < count; ++f)
+                        DotFrames<1>(e, &frames[f], len, &dot[f]);
+
+                    for(f = 0; f < count; ++f)
+                        partial[f*dims + k] += dot[f];
                 }
+            }
+        }
+    });
+
+    m_coefficients.create(count, dims, CV_32F);
+    for(int f = 0; f < count; ++f)
+    {
+        for(int k = 0; k < dims; ++k)
+        {
+            double sum = 0;
+            for(int r = 0; r < rows; ++r)
+                sum += m_partial[((size_t)r*count + f)*dims + k];
+            m_coefficients.at<float>(f, k) = (float)sum;
+        }
+    }
+}
 
-                if(!bgHigh)
+// Reconstruct the frames from their coefficients a chunk of a row at a time and compare them
+// with the frames, so a reconstruction never exists as a whole. Each chunk of an eigenvector
+// is applied to all the frames of a batch while it is in cache.
+void Eigenbackground::Threshold(const cv::Mat* images, int count, cv::Mat* low_threshold_masks,
+                                cv::Mat* high_threshold_masks)
+{
+    const int rows = m_params.Height();
+    const int channels = m_params.Channels();
+    const int row_len = m_params.Width()*channels;
+    const int dims = m_basis.rows;
+    const float low = m_params.LowThreshold();
+    const float high = m_params.HighThreshold();
+
+    ParallelRows(rows, m_params.Threads(), [&](int row_begin, int row_end)
+    {
+        std::vector<float> reconstruction((size_t)count*CHUNK);
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const long pos = (long)r*row_len;
+            for(int begin = 0; begin < row_len; begin += CHUNK)
+            {
+                const int len = std::min(CHUNK, row_len - begin);
+
+                for(int f = 0; f < count; ++f)
+                    memcpy(&reconstruction[(size_t)f*CHUNK], m_basis_mean.ptr<float>() + pos + begin, len*sizeof(float));
+
+                for(int k = 0; k < dims; ++k)
                 {
-                    high_threshold_mask.at<unsigned char>(r,c) = FOREGROUND;
+                    const float* e = m_basis.ptr<float>(k) + pos + begin;
+                    for(int f = 0; f < count; ++f)
+                        Axpy(&reconstruction[(size_t)f*CHUNK], m_coefficients.at<float>(f, k), e, len);
                 }
-                else
+
+                // Euclidean distance per channel between the image and its reconstruction
+                for(int f = 0; f < count; ++f)
                 {
-                    high_threshold_mask.at<unsigned char>(r,c) = BACKGROUND;
+                    const float* rec = &reconstruction[(size_t)f*CHUNK];
+                    const unsigned char* pixels = images[f].ptr<unsigned char>(r) + begin;
+                    unsigned char* lowMask = low_threshold_masks[f].ptr<unsigned char>(r) + begin/channels;
+                    unsigned char* highMask = high_threshold_masks[f].ptr<unsigned char>(r) + begin/channels;
+                    for(int c = 0; c < len/channels; ++c)
+                    {
+                        float dist = 0;
+                        for(int ch = 0; ch < channels; ++ch)
+                        {
+                            int i = c*channels + ch;
+                            dist = std::max(dist, fabsf(pixels[i] - rec[i]));
+                        }
+
+                        lowMask[c] = (dist > low) ? FOREGROUND : BACKGROUND;
+                        highMask[c] = (dist > high) ? FOREGROUND : BACKGROUND;
+                    }
                 }
             }
         }
-    }
-    else
+    });
+}
+
+void Eigenbackground::SubtractBatch(const std::vector<cv::Mat>& images, std::vector<cv::Mat>& low_threshold_masks,
+                                    std::vector<cv::Mat>& high_threshold_masks)
+{
+    const int count = (int)images.size();
+    low_threshold_masks.resize(count);
+    high_threshold_masks.resize(count);
+
+    // frames that may build or change the eigenspace go through Subtract() one at a time
+    int first = 0;
+    while(first < count && (m_basis.empty() || m_frame_num <= m_params.HistorySize() ||
+                            m_params.RebuildInterval() > 0 || m_rebuild.joinable()))
     {
-        //std::cout << "else" << std::endl;
+        Subtract(images[first], low_threshold_masks[first], high_threshold_masks[first]);
+        first++;
+    }
 
-        UpdateHistory(image);
+    if(first == count)
+        return;
 
-        // set entire image to background since there is not enough information yet
-        // to start performing background subtraction
-        for(unsigned int r = 0; r < m_params.Height(); ++r)
-        {
-            for(unsigned int c = 0; c < m_params.Width(); ++c)
-            {
-                low_threshold_mask.at<unsigned char>(r,c) = BACKGROUND;
-                high_threshold_mask.at<unsigned char>(r,c) = BACKGROUND;
-            }
-        }
+    for(int f = first; f < count; ++f)
+    {
+        if(low_threshold_masks[f].empty())
+            low_threshold_masks[f].create(m_params.Height(), m_params.Width(), CV_8U);
+        if(high_threshold_masks[f].empty())
+            high_threshold_masks[f].create(m_params.Height(), m_params.Width(), CV_8U);
     }
 
-    m_frame_num++;
+    Project(&images[first], count - first);
+    Threshold(&images[first], count - first, &low_threshold_masks[first], &high_threshold_masks[first]);
+
+    // Update() works on the last frame
+    m_coefficients = m_coefficients.row(count - first - 1).clone();
+    m_frame_num += count - first;
 }
 
 cv::Mat Eigenbackground::norm_0_255(cv::InputArray _src)
@@ -282,11 +661,221 @@ cv::Mat Eigenbackground::norm_0_255(cv::InputArray _src)
 
 void Eigenbackground::Update(const cv::Mat& image,  const cv::Mat& update_mask)
 {
-    // the eigenbackground model is not updated (serious limitation!)
+    // without an update interval the eigenspace stays as it was built from the history
+    if(m_params.UpdateInterval() <= 0 || m_frame_num <= m_params.HistorySize() || m_coefficients.empty())
+        return;
+
+    if(m_frame_num % m_params.UpdateInterval() != 0)
+        return;
+
+    if(m_pca.eigenvectors.depth() == CV_32F)
+        UpdateEigenspace<float>(image, update_mask);
+    else
+        UpdateEigenspace<double>(image, update_mask);
+    UseEigenspace();
+
+    m_background = norm_0_255(m_pca.mean.reshape(m_background.channels(), m_params.Height()));
+}
+
+// Fold a frame into the eigenspace with candid covariance-free incremental PCA, from
+// "Candid Covariance-Free Incremental Principal Component Analysis" by J. Weng et al.
+// With learning rate a and v_i = eigenvalue_i * eigenvector_i, for i = 1..k:
+//
+//     v_i <- (1-a) v_i + a (u.v_i / |v_i|) u
+//     u   <- u - (u.v_i / |v_i|^2) v_i
+//
+// where u starts as the frame minus the mean. The updated norm and dot product follow from
+// u.e_i and |u|^2, so each eigenvector takes a single pass over the frame, which also
+// accumulates the dot product for the next one. The cost per update is O(k*D) whatever the
+// history size.
+template<class T>
+void Eigenbackground::UpdateEigenspace(const cv::Mat& image, const cv::Mat& update_mask)
+{
+    const int rows = m_params.Height();
+    const int cols = m_params.Width();
+    const int channels = m_params.Channels();
+    const int row_len = cols*channels;
+    const int dims = m_pca.eigenvectors.rows;
+    const double a = m_params.UpdateRate();
+
+    m_residual.create(1, rows*row_len, m_pca.mean.type());
+    T* u = m_residual.ptr<T>();
+    T* mean = m_pca.mean.ptr<T>();
+    const float* coefficients = m_coefficients.ptr<float>();
+
+    // per row sums, added up in order so the result does not depend on the threads
+    std::vector<double> dot(rows), norm(rows);
+
+    // Residual of the frame against the mean, which moves towards the frame. Pixels that are
+    // not background take the value the eigenspace reconstructs for them instead, so objects
+    // in front of the background are not learned.
+    ParallelRows(rows, m_params.Threads(), [&](int row_begin, int row_end)
+    {
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const unsigned char* pixels = image.ptr<unsigned char>(r);
+            const unsigned char* mask = update_mask.empty() ? 0 : update_mask.ptr<unsigned char>(r);
+            long pos = (long)r*row_len;
+            const T* e = m_pca.eigenvectors.ptr<T>(0) + pos;
+
+            double d = 0, n = 0;
+            for(int c = 0; c < cols; ++c)
+            {
+                for(int ch = 0; ch < channels; ++ch)
+                {
+                    int i = c*channels + ch;
+                    double x;
+                    if(mask && mask[c] != BACKGROUND)
+                    {
+                        x = 0;
+                        for(int k = 0; k < dims; ++k)
+                            x += coefficients[k]*m_pca.eigenvectors.ptr<T>(k)[pos+i];
+                    }
+                    else
+                    {
+                        x = pixels[i] - mean[pos+i];
+                    }
+
+                    u[pos+i] = (T)x;
+                    mean[pos+i] = (T)(mean[pos+i] + a*x);
+                    d += x*e[i];
+                    n += x*x;
+                }
+            }
+            dot[r] = d;
+            norm[r] = n;
+        }
+    });
+
+    for(int k = 0; k < dims; ++k)
+    {
+        double d = 0, n = 0;
+        for(int r = 0; r < rows; ++r)
+        {
+            d += dot[r];
+            n += norm[r];
+        }
+
+        T* eigenvalue = &m_pca.eigenvalues.at<T>(k);
+        double lambda = *eigenvalue;
+        double lambdaNew = sqrt((1-a)*(1-a)*lambda*lambda + 2*(1-a)*a*lambda*d*d + a*a*d*d*n);
+        if(lambdaNew <= 0)
+            break;
+
+        // new eigenvector e' = ((1-a) lambda e + a d u) / lambda', and the residual loses its
+        // component g = u.e' along it
+        const T scaleE = (T)((1-a)*lambda/lambdaNew);
+        const T scaleU = (T)(a*d/lambdaNew);
+        const T g = (T)(((1-a)*lambda*d + a*d*n)/lambdaNew);
+        *eigenvalue = (T)lambdaNew;
+
+        ParallelRows(rows, m_params.Threads(), [&](int row_begin, int row_end)
+        {
+            for(int r = row_begin; r < row_end; ++r)
+            {
+                long pos = (long)r*row_len;
+                T* e = m_pca.eigenvectors.ptr<T>(k) + pos;
+                const T* next = (k+1 < dims) ? m_pca.eigenvectors.ptr<T>(k+1) + pos : 0;
+                T* ur = u + pos;
+
+                double dn = 0, nn = 0;
+                for(int i = 0; i < row_len; ++i)
+                {
+                    T ei = scaleE*e[i] + scaleU*ur[i];
+                    T ui = ur[i] - g*ei;
+                    e[i] = ei;
+                    ur[i] = ui;
+                    if(next)
+                        dn += (double)ui*next[i];
+                    nn += (double)ui*ui;
+                }
+                dot[r] = dn;
+                norm[r] = nn;
+            }
+        });
+    }
+
+    Orthonormalize<T>();
+}
+
+// The incremental update only keeps the eigenvectors approximately orthogonal and the
+// error adds up over the updates, while the projection relies on an orthonormal basis.
+// Classical Gram-Schmidt against the eigenvectors before it is enough, as each update
+// only turns them slightly.
+template<class T>
+void Eigenbackground::Orthonormalize()
+{
+    const int rows = m_params.Height();
+    const int row_len = m_params.Width()*m_params.Channels();
+    const int dims = m_pca.eigenvectors.rows;
+
+    // per row sums, added up in order so the result does not depend on the threads
+    std::vector<double> partial(rows*dims);
+    std::vector<double> coeff(dims);
+
+    for(int k = 0; k < dims; ++k)
+    {
+        // components of e_k along e_0 .. e_k-1 and the norm of e_k
+        ParallelRows(rows, m_params.Threads(), [&](int row_begin, int row_end)
+        {
+            for(int r = row_begin; r < row_end; ++r)
+            {
+                long pos = (long)r*row_len;
+                const T* e = m_pca.eigenvectors.ptr<T>(k) + pos;
+                for(int j = 0; j <= k; ++j)
+                {
+                    const T* ej = m_pca.eigenvectors.ptr<T>(j) + pos;
+                    double d = 0;
+                    for(int i = 0; i < row_len; ++i)
+                        d += (double)e[i]*ej[i];
+                    partial[r*dims + j] = d;
+                }
+            }
+        });
+
+        for(int j = 0; j <= k; ++j)
+        {
+            coeff[j] = 0;
+            for(int r = 0; r < rows; ++r)
+                coeff[j] += partial[r*dims + j];
+        }
+
+        // |e_k - sum c_j e_j|^2 = |e_k|^2 - sum c_j^2 as the e_j are orthonormal
+        double norm = coeff[k];
+        for(int j = 0; j < k; ++j)
+            norm -= coeff[j]*coeff[j];
+        if(norm <= 0)
+            break;
+        const double scale = 1/sqrt(norm);
+
+        ParallelRows(rows, m_params.Threads(), [&](int row_begin, int row_end)
+        {
+            for(int r = row_begin; r < row_end; ++r)
+            {
+                long pos = (long)r*row_len;
+                T* e = m_pca.eigenvectors.ptr<T>(k) + pos;
+                for(int j = 0; j < k; ++j)
+                {
+                    const T* ej = m_pca.eigenvectors.ptr<T>(j) + pos;
+                    const T c = (T)coeff[j];
+                    for(int i = 0; i < row_len; ++i)
+                        e[i] -= c*ej[i];
+                }
+                for(int i = 0; i < row_len; ++i)
+                    e[i] = (T)(e[i]*scale);
+            }
+        });
+    }
 }
 
 void Eigenbackground::UpdateHistory(const cv::Mat& image)
 {
+    if(m_params.SnapshotTraining())
+    {
+        m_history.Add(image, m_params.Threads());
+        return;
+    }
+
     cv::Mat image_row = image.clone().reshape(1,1);
 
     if(m_params.Precision() == 1)
@@ -294,5 +883,98 @@ void Eigenbackground::UpdateHistory(const cv::Mat& image)
     else
         image_row.convertTo(image_row,CV_64FC1);
 
-    m_pcaImages.push_back(image_row);
+    // once the history is full a frame replaces the oldest one
+    if(m_pcaImages.rows < m_params.HistorySize())
+        m_pcaImages.push_back(image_row);
+    else
+    {
+        cv::Mat oldest = m_pcaImages.row(m_frame_num % m_params.HistorySize());
+        image_row.copyTo(oldest);
+    }
+}
+
+// Empty the history for the frame size in m_params. After Load() it refills from the frames
+// that follow before the next rebuild.
+void Eigenbackground::ResetHistory()
+{
+    m_pcaImages.release();
+    if(m_params.SnapshotTraining())
+        m_history.Initalize(m_params.HistorySize(), m_params.Size()*m_params.Channels());
+}
+
+bool Eigenbackground::RebuildDue()
+{
+    const int history = m_params.HistorySize();
+    if(m_frame_num == history)
+        return true;
+
+    const int interval = m_params.RebuildInterval();
+    if(interval <= 0 || m_frame_num < history || (m_frame_num - history) % interval != 0)
+        return false;
+
+    // a rebuild that is still running is not queued behind, and after Load() there is no
+    // history to rebuild from until it has filled up again
+    if(m_rebuild.joinable())
+        return false;
+    int frames = m_params.SnapshotTraining() ? m_history.Count() : m_pcaImages.rows;
+    return frames == history;
+}
+
+void Eigenbackground::StartRebuild()
+{
+    // The worker needs a copy of the history if frames keep being added to it. Otherwise
+    // it can share it.
+    const bool copy = m_params.RebuildInterval() > 0;
+    cv::Mat images = copy ? m_pcaImages.clone() : m_pcaImages;
+    SnapshotPca history = copy ? m_history.Clone() : m_history;
+    EigenbackgroundParams params = m_params;
+
+    m_rebuild_done = false;
+    m_rebuild = std::thread([this, images, history, params]() mutable
+    {
+        // on a single thread, so the frames keep the pool to themselves
+        try
+        {
+            ComputeEigenspace(params, images, history, 1, m_next_pca);
+        }
+        catch(...)
+        {
+            m_rebuild_error = std::current_exception();
+        }
+        m_rebuild_done = true;
+    });
+}
+
+void Eigenbackground::FinishRebuild()
+{
+    m_rebuild.join();
+    m_rebuild_done = false;
+
+    if(m_rebuild_error)
+    {
+        std::exception_ptr error = m_rebuild_error;
+        m_rebuild_error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+
+    m_pca = m_next_pca;
+    m_next_pca = cv::PCA();
+    UseEigenspace();
+    m_background = norm_0_255(m_pca.mean.reshape(m_background.channels(), m_params.Height()));
+}
+
+void Eigenbackground::ComputeEigenspace(EigenbackgroundParams& params, const cv::Mat& images,
+                                        const SnapshotPca& history, unsigned int threads, cv::PCA& pca)
+{
+    if(params.SnapshotTraining())
+    {
+        history.Compute(pca, params.EmbeddedDim(), params.RetainedVar(),
+                        params.Precision() == 1 ? CV_32F : CV_64F, threads);
+    }
+    else if(params.EmbeddedDim() == 0)
+    {
+        pca = cv::PCA(images, cv::Mat(), CV_PCA_DATA_AS_ROW, params.RetainedVar());
+    }
+    else
+        pca = cv::PCA(images, cv::Mat(), CV_PCA_DATA_AS_ROW, params.EmbeddedDim());
 }
@@ -16,7 +16,14 @@
 #ifndef _EIGENBACKGROUND_H_
 #define _EIGENBACKGROUND_H_
 
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+
 #include "Bgs.hpp"
+#include "ModelFile.hpp"
+#include "SnapshotPca.hpp"
 
 namespace bgs
 {
@@ -29,6 +36,11 @@ public:
         m_history_size = 100;
         m_dim = 20;
         m_precision = 2;
+        m_snapshot_training = false;
+        m_rebuild_interval = 0;
+        m_async_rebuild = false;
+        m_update_interval = 0;
+        m_update_rate = 0.01f;
         m_low_threshold = 50;
         m_high_threshold = 2*m_low_threshold;    // Note: high threshold is used by post-processing
     }
@@ -38,6 +50,28 @@ public:
     float &RetainedVar() { return m_var; }
     int &Precision() { return m_precision; }
 
+    // Keep the history as 8-bit frames in a ring and build the eigenspace from their Gram
+    // matrix (see SnapshotPca.hpp) instead of from a double copy of every frame.
+    bool &SnapshotTraining() { return m_snapshot_training; }
+
+    // 0 builds the eigenspace once from the first HistorySize() frames. N > 0 keeps the last
+    // HistorySize() frames and rebuilds it from them every N frames after that.
+    int &RebuildInterval() { return m_rebuild_interval; }
+
+    // Build the eigenspace on a thread of its own. Subtract() keeps using the current one
+    // (or, for the first build, keeps reporting background) until the new one is ready, and
+    // swaps it in at the start of the next frame, so no frame waits for a build.
+    bool &AsyncRebuild() { return m_async_rebuild; }
+
+    // 0 keeps the eigenspace built from the first HistorySize() frames. N > 0 folds the
+    // background of every Nth frame into it when Update() is called, so it follows
+    // gradual changes such as lighting.
+    int &UpdateInterval() { return m_update_interval; }
+
+    // Weight of a frame folded into the eigenspace; the eigenspace forgets over about
+    // 1/UpdateRate() updates.
+    float &UpdateRate() { return m_update_rate; }
+
     void write(cv::FileStorage& fs) const {} // write serialization
     void read(const cv::FileNode& node){} // read serialization
 
@@ -46,6 +80,11 @@ private:
     int m_dim;                    // eigenspace dimensionality
     float m_var;
     int m_precision;
+    bool m_snapshot_training;     // build the eigenspace with SnapshotPca
+    int m_rebuild_interval;       // frames between eigenspace rebuilds, 0 for none
+    bool m_async_rebuild;         // build the eigenspace on a worker thread
+    int m_update_interval;        // frames between eigenspace updates, 0 for none
+    float m_update_rate;          // weight of a frame in an eigenspace update
 };
 
 }
@@ -60,6 +99,8 @@ public:
     Eigenbackground(const BgsParams& p);
     ~Eigenbackground();
 
+    // Names ending in ".bin" are saved in a binary format that Load() maps into memory and
+    // uses in place, see SaveBinary(). Load() tells the formats apart by their contents.
     void Save(std::string file = "Eigenbackground.xml");
     void Load(std::string file = "Eigenbackground.xml");
     void Load(float low_threshold, float high_threshold, std::string file = "Eigenbackground.xml")
@@ -73,17 +114,68 @@ public:
     void Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
     void Update(const cv::Mat& image,  const cv::Mat& update_mask);
 
+    // Subtract a batch of frames from the background model, with the same masks as calling
+    // Subtract() for each of them in turn. While the eigenspace stays the same over the batch
+    // (it is built, RebuildInterval() is 0 and no rebuild is running) the frames are projected
+    // together, one matrix product rather than a matrix-vector product per frame, which suits
+    // reprocessing recorded video. Update() is not called in between; calling it afterwards
+    // updates the model with the last frame.
+    void SubtractBatch(const std::vector<cv::Mat>& images, std::vector<cv::Mat>& low_threshold_masks,
+                       std::vector<cv::Mat>& high_threshold_masks);
+
     cv::Mat Background() { return m_background; }
 
+    // Eigenvectors of the background eigenspace, one per row, after any updates.
+    cv::Mat Eigenvectors() { return m_pca.eigenvectors; }
+
 private:
     void Initalize(const cv::Mat& image);
     void UpdateHistory(const cv::Mat& newFrame);
+    void ResetHistory();
+
+    void SaveBinary(const std::string& file);
+    bool LoadBinary(const std::string& file);
+
+    bool RebuildDue();
+    void StartRebuild();
+    void FinishRebuild();
+    static void ComputeEigenspace(EigenbackgroundParams& params, const cv::Mat& images,
+                                  const SnapshotPca& history, unsigned int threads, cv::PCA& pca);
+
+    void UseEigenspace();
+    void Project(const cv::Mat* images, int count);
+    void Threshold(const cv::Mat* images, int count, cv::Mat* low_threshold_masks, cv::Mat* high_threshold_masks);
+
+    template<class T>
+    void UpdateEigenspace(const cv::Mat& image, const cv::Mat& update_mask);
+    template<class T>
+    void Orthonormalize();
 
     EigenbackgroundParams m_params;
     cv::Mat m_pcaImages;
+    SnapshotPca m_history;
     int m_K;
     cv::PCA m_pca;
     cv::Mat m_background;
+
+    // eigenvectors and mean of m_pca as CV_32F, which is what frames are projected on
+    cv::Mat m_basis;
+    cv::Mat m_basis_mean;
+    // projection of the last frame (or of each frame of a batch) into the eigenspace, CV_32F
+    cv::Mat m_coefficients;
+    // per row sums of the projection
+    std::vector<double> m_partial;
+    // part of a frame not yet explained by the eigenspace while it is updated
+    cv::Mat m_residual;
+
+    // eigenspace being built by m_rebuild, m_rebuild_done once it can be swapped in
+    std::thread m_rebuild;
+    std::atomic<bool> m_rebuild_done;
+    std::exception_ptr m_rebuild_error;
+    cv::PCA m_next_pca;
+
+    // model file the eigenspace and background were loaded from, if they live in one
+    std::shared_ptr<MappedFile> m_model_file;
 };
 
 }
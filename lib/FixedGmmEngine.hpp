@@ -0,0 +1,555 @@
+/****************************************************************************
+*
+* FixedGmmEngine.hpp
+*
+* Purpose: Fixed-point version of the GmmEngine kernel for ZivkovicAGMM
+*          (modes ordered by weight, complexity reduction prior). Every
+*          model parameter is an unsigned 16-bit integer, which halves the
+*          model compared to the float engine and lets SSE2 update 8 pixels
+*          per instruction instead of 4:
+*
+*              mean       Q8.8   (pixel value * 256)
+*              variance   Q8.8
+*              weight     Q1.15  (1.0 = 32768, so a sum of weights up to
+*                                 2.0 fits without overflowing)
+*              gain       Q0.16  (alpha / weight, at most 1)
+*
+*          The division alpha/weight of the learning rate and the division
+*          by the total weight of the renormalisation are replaced by
+*          reciprocal tables, everything else is 16-bit multiply-high,
+*          saturating add/subtract and compare.
+*
+*          Divergence from the float engine: a single update of a mode
+*          differs by at most 1/256 in the mean and in the variance, by
+*          2^-15 in the weight and by 0.4% in the gain, and the squared
+*          distance is rounded to whole units (half a unit per channel)
+*          before it is compared against the thresholds. The constants of
+*          the weight update are dithered over the frames, so none of these
+*          errors builds up into a drift, but a pixel sitting right at a
+*          threshold can be classified differently. Measured on 640x480
+*          SyntheticScene sequences of 200 frames (seeds 1-4 and 7, 3..5
+*          modes, alpha 0.001..0.05), at most 0.08% of the mask pixels of
+*          any frame differ from the float path, and at most 0.023% over a
+*          whole sequence. test/test_fixedpoint.cpp checks 0.1% and 0.03%.
+*
+******************************************************************************/
+
+#ifndef BGS_FIXED_GMM_ENGINE_H_
+#define BGS_FIXED_GMM_ENGINE_H_
+
+#include <vector>
+
+#include "Bgs.hpp"
+#include "Simd.hpp"
+
+namespace bgs
+{
+
+template<int CHANNELS>
+class FixedGmmEngine
+{
+private:
+    // Same layout as the float engine: one padded row per mode slot, one column per pixel.
+    struct GMM_PLANES
+    {
+        cv::Mat variance;
+        cv::Mat weight;
+        cv::Mat mu[CHANNELS];
+    };
+
+    // weight of 1.0 and the largest weight a mode may have
+    enum { WEIGHT_ONE = 32768, WEIGHT_MAX = 32767 };
+
+    // the gain of weights below GAIN_FINE is looked up exactly, above it in steps of 16
+    enum { GAIN_FINE = 2048, GAIN_SHIFT = 4 };
+
+    // renormalisation factors are tabulated for totals within RENORM_RANGE of 1.0
+    enum { RENORM_RANGE = 2048 };
+
+public:
+    // largest number of modes per pixel supported
+    enum { MODES_LIMIT = 16 };
+
+    FixedGmmEngine()
+    {
+        m_alpha = 0.001f;
+        m_low_threshold = 9.0f;
+        m_high_threshold = 18.0f;
+        m_bg_threshold = 0.75f;
+        m_variance = 36.0f;
+        m_complexity_prior = 0.05f;
+        m_max_modes = 0;
+        m_gain_alpha = -1.0f;
+        m_alpha_error = 0.0;
+        m_decay_error = 0.0;
+        m_prune_error = 0.0;
+    }
+
+    // Same parameters as GmmEngine.
+    float &Alpha() { return m_alpha; }
+    float &LowThreshold() { return m_low_threshold; }
+    float &HighThreshold() { return m_high_threshold; }
+    float &BgThreshold() { return m_bg_threshold; }
+    float &Variance() { return m_variance; }
+    float &ComplexityPrior() { return m_complexity_prior; }
+
+    // Allocate an empty model for width x height pixels with up to max_modes modes each. The
+    // thresholds and 5*Variance(), the variance limit, must be in [0,256) to fit Q8.8.
+    void Initalize(int width, int height, int max_modes)
+    {
+        if(max_modes < 1 || max_modes > MODES_LIMIT)
+            CV_Error( CV_StsOutOfRange, "The number of modes per pixel must be between 1 and 16" );
+        CheckRange();
+
+        m_width = width;
+        m_max_modes = max_modes;
+
+        int stride = (width*height + 15) & ~15;
+        m_modes.variance = cv::Mat::zeros(max_modes, stride, CV_16U);
+        m_modes.weight = cv::Mat::zeros(max_modes, stride, CV_16U);
+        for(int ch = 0; ch < CHANNELS; ++ch)
+            m_modes.mu[ch] = cv::Mat::zeros(max_modes, stride, CV_16U);
+
+        m_modes_per_pixel = cv::Mat::zeros(height, width, CV_8U);
+
+        // (1/total - 1) and (1 - 1/total) for totals just below and above 1.0
+        m_renorm_up.resize(RENORM_RANGE);
+        m_renorm_down.resize(RENORM_RANGE);
+        for(int e = 0; e < RENORM_RANGE; ++e)
+        {
+            m_renorm_up[e] = Round16(65536.0*e / (WEIGHT_ONE - e));
+            m_renorm_down[e] = Round16(65536.0*e / (WEIGHT_ONE + e));
+        }
+
+        m_gain_alpha = -1.0f;
+        m_alpha_error = 0.0;
+        m_decay_error = 0.0;
+        m_prune_error = 0.0;
+    }
+
+    // Convert the parameters to fixed point. Must be called once per frame before SubtractRows,
+    // and not while SubtractRows runs.
+    void Prepare()
+    {
+        CheckRange();
+
+        // the rounding error of the weight update constants is carried over to the next frame,
+        // so on average the weights are updated with the exact float constants and do not drift
+        m_q_alpha = Dither(m_alpha*WEIGHT_ONE, m_alpha_error, 1);
+        m_q_decay = Dither(m_alpha*65536.0, m_decay_error, 1);
+        m_q_prune = Dither(m_alpha*m_complexity_prior*WEIGHT_ONE, m_prune_error);
+        if(m_q_prune > m_q_alpha)
+            m_q_prune = m_q_alpha;
+        m_q_low = Round16(m_low_threshold*256.0);
+        m_q_high = Round16(m_high_threshold*256.0);
+        m_q_bg = Round16(m_bg_threshold*WEIGHT_ONE);
+        m_q_variance = Round16(m_variance*256.0);
+        m_q_max_variance = Round16(5*m_variance*256.0);
+
+        if(m_alpha != m_gain_alpha)
+        {
+            // alpha/weight in Q0.16, exact for small weights and at the middle of each step for large ones
+            m_gain_fine.resize(GAIN_FINE);
+            for(int w = 0; w < GAIN_FINE; ++w)
+                m_gain_fine[w] = w == 0 ? 0xffff : Round16(m_alpha*65536.0*WEIGHT_ONE / w);
+
+            m_gain_coarse.resize(WEIGHT_ONE >> GAIN_SHIFT);
+            for(int i = 0; i < (WEIGHT_ONE >> GAIN_SHIFT); ++i)
+                m_gain_coarse[i] = Round16(m_alpha*65536.0*WEIGHT_ONE / ((i << GAIN_SHIFT) + (1 << (GAIN_SHIFT-1))));
+
+            m_gain_alpha = m_alpha;
+        }
+    }
+
+    // Update the model with rows [row_begin, row_end) of image and write the masks for those
+    // rows. Disjoint ranges of rows may be processed concurrently.
+    void SubtractRows(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask,
+                      int row_begin, int row_end)
+    {
+        switch(m_max_modes)
+        {
+        case 2: SubtractRange<2>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        case 3: SubtractRange<3>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        case 4: SubtractRange<4>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        case 5: SubtractRange<5>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        default: SubtractRange<0>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        }
+    }
+
+    // Write rows [row_begin, row_end) of the background image, the mean of the first mode of each
+    // pixel. Disjoint ranges of rows may be processed concurrently.
+    void BackgroundRows(cv::Mat& background, int row_begin, int row_end)
+    {
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            unsigned char* pBackground = background.ptr<unsigned char>(r);
+            long posPixel = r*m_width;
+            for(int ch = 0; ch < CHANNELS; ++ch)
+            {
+                const unsigned short* mu = Slot(m_modes.mu[ch], 0, posPixel);
+                for(int c = 0; c < m_width; ++c)
+                    pBackground[CHANNELS*c+ch] = (unsigned char)(mu[c] >> 8);
+            }
+        }
+    }
+
+private:
+    static bool FitsQ8_8(float x) { return x >= 0.0f && x < 256.0f; }
+
+    // Round16() would clamp larger values, and the model would silently use other thresholds
+    // than the float one
+    void CheckRange() const
+    {
+        if(!FitsQ8_8(m_low_threshold) || !FitsQ8_8(m_high_threshold) || !FitsQ8_8(5*m_variance))
+            CV_Error( CV_StsOutOfRange, "LowThreshold(), HighThreshold() and 5*Variance() must be below 256 in fixed point" );
+    }
+
+    static unsigned short Round16(double x, int min_value = 0)
+    {
+        if(x < min_value)
+            return (unsigned short)min_value;
+        if(x >= 65535.0)
+            return 0xffff;
+        return (unsigned short)(x + 0.5);
+    }
+
+    // round x + error and keep the part lost to rounding in error
+    static unsigned short Dither(double x, double& error, int min_value = 0)
+    {
+        unsigned short q = Round16(x + error, min_value);
+        error += x - q;
+        return q;
+    }
+
+    template<int MAX_MODES>
+    void SubtractRange(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask,
+                       int row_begin, int row_end)
+    {
+        const int step = simd::VU16::WIDTH;
+
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const unsigned char* pixels = image.ptr<unsigned char>(r);
+            unsigned char* numModes = m_modes_per_pixel.ptr<unsigned char>(r);
+            unsigned char* low = low_threshold_mask.ptr<unsigned char>(r);
+            unsigned char* high = high_threshold_mask.ptr<unsigned char>(r);
+            long posPixel = r*m_width;
+
+            int c = 0;
+            for(; c + step <= m_width; c += step)
+                SubtractPixels<simd::VU16, MAX_MODES>(posPixel+c, pixels+CHANNELS*c, numModes+c, low+c, high+c);
+            for(; c < m_width; ++c)
+                SubtractPixels<simd::VU16x1, MAX_MODES>(posPixel+c, pixels+CHANNELS*c, numModes+c, low+c, high+c);
+        }
+    }
+
+    static unsigned short* Slot(cv::Mat& plane, int i, long posPixel)
+    {
+        return plane.ptr<unsigned short>(i) + posPixel;
+    }
+
+    template<class V>
+    static void SwapSlots(cv::Mat& plane, int i, long posPixel, const typename V::Mask& swap)
+    {
+        unsigned short* a = plane.ptr<unsigned short>(i) + posPixel;
+        unsigned short* b = plane.ptr<unsigned short>(i+1) + posPixel;
+        V va = V::load(a);
+        V vb = V::load(b);
+        V::store(a, v_select(swap, vb, va));
+        V::store(b, v_select(swap, va, vb));
+    }
+
+    // alpha/weight of every lane
+    template<class V>
+    V Gain(const V& weight) const
+    {
+        unsigned short w[V::WIDTH];
+        unsigned short k[V::WIDTH];
+        V::store(w, weight);
+        for(int l = 0; l < V::WIDTH; ++l)
+            k[l] = w[l] < GAIN_FINE ? m_gain_fine[w[l]] : m_gain_coarse[w[l] >> GAIN_SHIFT];
+        return V::load(k);
+    }
+
+    // Factors that scale the weights of each lane so they add up to one again:
+    // weight*(1/total) = weight + weight*up - weight*down
+    template<class V>
+    void RenormFactors(const V& total, V& up, V& down) const
+    {
+        unsigned short t[V::WIDTH];
+        unsigned short u[V::WIDTH];
+        unsigned short d[V::WIDTH];
+        V::store(t, total);
+        for(int l = 0; l < V::WIDTH; ++l)
+        {
+            int e = (int)t[l] - WEIGHT_ONE;
+            u[l] = 0;
+            d[l] = 0;
+            if(t[l] == 0)
+                continue;
+            else if(e < 0)
+                u[l] = -e < RENORM_RANGE ? m_renorm_up[-e] : Round16(-65536.0*e / t[l]);
+            else if(e > 0)
+                d[l] = e < RENORM_RANGE ? m_renorm_down[e] : Round16(65536.0*e / t[l]);
+        }
+        up = V::load(u);
+        down = V::load(d);
+    }
+
+    template<class V, int MAX_MODES>
+    void SortModes(long posPixel, const V& nModes)
+    {
+        typedef typename V::Mask M;
+
+        const int maxModes = MAX_MODES > 0 ? MAX_MODES : m_max_modes;
+
+        V keys[MAX_MODES > 0 ? MAX_MODES : MODES_LIMIT];
+        for(int i = 0; i < maxModes; ++i)
+            keys[i] = V::load(Slot(m_modes.weight, i, posPixel));
+
+        for(int pass = 0; pass < maxModes; ++pass)
+        {
+            for(int i = pass & 1; i+1 < maxModes; i += 2)
+            {
+                M swap = (V::set1((unsigned short)(i+1)) < nModes) & (keys[i+1] > keys[i]);
+                if(!swap.any())
+                    continue;
+
+                V ka = keys[i];
+                V kb = keys[i+1];
+                keys[i] = v_select(swap, kb, ka);
+                keys[i+1] = v_select(swap, ka, kb);
+
+                SwapSlots<V>(m_modes.variance, i, posPixel, swap);
+                SwapSlots<V>(m_modes.weight, i, posPixel, swap);
+                for(int ch = 0; ch < CHANNELS; ++ch)
+                    SwapSlots<V>(m_modes.mu[ch], i, posPixel, swap);
+            }
+        }
+    }
+
+    // Scale the weights of the lanes in mask by 1/total.
+    template<class V, int MAX_MODES>
+    void Renormalize(long posPixel, const typename V::Mask& mask, const V& nModes, const V& total)
+    {
+        typedef typename V::Mask M;
+
+        const int maxModes = MAX_MODES > 0 ? MAX_MODES : m_max_modes;
+        const V weightMax = V::set1(WEIGHT_MAX);
+
+        V up, down;
+        RenormFactors(total, up, down);
+
+        for(int iLocal = 0; iLocal < maxModes; ++iLocal)
+        {
+            M active = mask & (V::set1((unsigned short)iLocal) < nModes);
+            if(!active.any())
+                break;
+
+            unsigned short* pWeight = Slot(m_modes.weight, iLocal, posPixel);
+            V weight = V::load(pWeight);
+            V scaled = v_min(v_subs(v_adds(weight, v_mulhi_round(weight, up)), v_mulhi_round(weight, down)), weightMax);
+            V::store(pWeight, v_select(active, scaled, weight));
+        }
+    }
+
+    // The float kernel of GmmEngine with WeightOrder, ComplexityPrune and StandardMatch, in fixed point.
+    template<class V, int MAX_MODES>
+    void SubtractPixels(long posPixel, const unsigned char* pixels, unsigned char* numModes, unsigned char* low_threshold, unsigned char* high_threshold)
+    {
+        typedef typename V::Mask M;
+
+        const int maxModes = MAX_MODES > 0 ? MAX_MODES : m_max_modes;
+        const V zero = V::zero();
+        const V one = V::set1(1);
+        const V alpha = V::set1(m_q_alpha);
+        const V decay = V::set1(m_q_decay);
+        const V prune = V::set1(m_q_prune);
+        const V minWeight = V::set1((unsigned short)(2*m_q_prune));
+        const V matchGain = V::set1((unsigned short)(m_q_alpha - m_q_prune));
+        const V weightMax = V::set1(WEIGHT_MAX);
+        const V lowThreshold = V::set1(m_q_low);
+        const V highThreshold = V::set1(m_q_high);
+        const V bgThreshold = V::set1(m_q_bg);
+        const V minVariance = V::set1(4*256);
+        const V maxVariance = V::set1(m_q_max_variance);
+        const V byteMax = V::set1(255);
+        const V saturated = V::set1(0xffff);
+
+        V pixel[CHANNELS];
+        for(int ch = 0; ch < CHANNELS; ++ch)
+            pixel[ch] = v_shl(V::load_u8(pixels+ch, CHANNELS), 8);
+
+        V nModes = V::load_u8(numModes);
+
+        M bFitsPDF = M::none();
+        M bBackgroundLow = M::none();
+        M bBackgroundHigh = M::none();
+
+        V sum = zero;
+        V totalWeight = zero;
+
+        for(int iModes = 0; iModes < maxModes; ++iModes)
+        {
+            M active = V::set1((unsigned short)iModes) < nModes;
+            if(!active.any())
+                break;
+
+            unsigned short* pVar = Slot(m_modes.variance, iModes, posPixel);
+            unsigned short* pWeight = Slot(m_modes.weight, iModes, posPixel);
+            V var = V::load(pVar);
+            V weight = V::load(pWeight);
+
+            M background = active & (sum < bgThreshold);
+            sum = v_adds(sum, v_select(active, weight, zero));
+
+            // squared distance rounded to whole units, saturating at 65535
+            V mu[CHANNELS];
+            V d[CHANNELS];
+            V dist = zero;
+            for(int ch = 0; ch < CHANNELS; ++ch)
+            {
+                mu[ch] = V::load(Slot(m_modes.mu[ch], iModes, posPixel));
+                d[ch] = v_absdiff(mu[ch], pixel[ch]);
+                dist = v_adds(dist, v_mulhi_round(d[ch], d[ch]));
+            }
+
+            M check = active & ~bFitsPDF;
+            bBackgroundHigh = bBackgroundHigh | (check & background & (dist < v_mulhi(highThreshold, var)));
+
+            M matched = check & (dist < v_mulhi(lowThreshold, var));
+            bBackgroundLow = bBackgroundLow | (matched & background);
+            bFitsPDF = bFitsPDF | matched;
+
+            // (1-alpha)*weight - alpha*cT, plus alpha for the matched mode
+            V decayed = weight - v_mulhi_round(weight, decay);
+            V newWeight = v_select(matched, v_min(v_adds(decayed, matchGain), weightMax), v_subs(decayed, prune));
+
+            // discard modes that became too weak
+            M pruned = active & ~matched & (decayed < minWeight);
+            newWeight = v_select(pruned, zero, newWeight);
+            nModes = v_select(pruned, nModes - one, nModes);
+
+            if(matched.any())
+            {
+                V k = Gain(weight);
+
+                // var + k*(dist - var); distances of 256 and more do not fit Q8.8 and use
+                // (k*(dist - var)) >> 8 assembled from both halves of the product instead
+                V distQ = v_shl(dist, 8);
+                M small = dist < V::set1(256);
+                M grow = ~small | (distQ > var);
+                V sigmanew = v_select(grow, v_adds(var, v_mulhi_round(k, v_subs(distQ, var))),
+                                            v_subs(var, v_mulhi_round(k, v_subs(var, distQ))));
+                if((~small).any())
+                {
+                    V delta = dist - v_shr(var, 8);
+                    V hi = v_mulhi(k, delta);
+                    V step = v_select(hi > byteMax, saturated, v_shl(hi, 8) + v_shr(v_mullo(k, delta), 8));
+                    sigmanew = v_select(small, sigmanew, v_adds(var, step));
+                }
+                sigmanew = v_min(v_max(sigmanew, minVariance), maxVariance);
+                V::store(pVar, v_select(matched, sigmanew, var));
+
+                // mu - k*(mu - pixel), never overshoots since k <= 1
+                for(int ch = 0; ch < CHANNELS; ++ch)
+                {
+                    V delta = v_mulhi_round(k, d[ch]);
+                    V moved = v_select(mu[ch] > pixel[ch], mu[ch] - delta, mu[ch] + delta);
+                    V::store(Slot(m_modes.mu[ch], iModes, posPixel), v_select(matched, moved, mu[ch]));
+                }
+            }
+
+            V::store(pWeight, v_select(active, newWeight, weight));
+
+            totalWeight = v_adds(totalWeight, v_select(active, newWeight, zero));
+        }
+
+        Renormalize<V, MAX_MODES>(posPixel, ~M::none(), nModes, totalWeight);
+
+        SortModes<V, MAX_MODES>(posPixel, nModes);
+
+        // make new mode if needed and exit
+        M create = ~bFitsPDF;
+        if(create.any())
+        {
+            V maxModesV = V::set1((unsigned short)maxModes);
+            V newModes = v_select(create, v_min(nModes + one, maxModesV), nModes);
+            V newWeight = v_select(newModes == one, weightMax, alpha);
+            V newVariance = V::set1(m_q_variance);
+
+            V total = zero;
+            for(int iLocal = 0; iLocal < maxModes; ++iLocal)
+            {
+                V slot = V::set1((unsigned short)iLocal);
+                M active = slot < newModes;
+                if(!active.any())
+                    break;
+
+                M target = create & (slot == newModes - one);
+                unsigned short* pWeight = Slot(m_modes.weight, iLocal, posPixel);
+                unsigned short* pVar = Slot(m_modes.variance, iLocal, posPixel);
+
+                V weight = v_select(target, newWeight, V::load(pWeight));
+                V::store(pWeight, weight);
+                V::store(pVar, v_select(target, newVariance, V::load(pVar)));
+                for(int ch = 0; ch < CHANNELS; ++ch)
+                {
+                    unsigned short* pMu = Slot(m_modes.mu[ch], iLocal, posPixel);
+                    V::store(pMu, v_select(target, pixel[ch], V::load(pMu)));
+                }
+
+                total = v_adds(total, v_select(active, weight, zero));
+            }
+
+            Renormalize<V, MAX_MODES>(posPixel, create, newModes, total);
+
+            nModes = newModes;
+
+            SortModes<V, MAX_MODES>(posPixel, nModes);
+        }
+
+        V::store_u8(numModes, nModes);
+        v_store_mask_u8(low_threshold, bBackgroundLow, Bgs::BACKGROUND, Bgs::FOREGROUND);
+        v_store_mask_u8(high_threshold, bBackgroundHigh, Bgs::BACKGROUND, Bgs::FOREGROUND);
+    }
+
+    // mixture parameters
+    float m_alpha;
+    float m_low_threshold;
+    float m_high_threshold;
+    float m_bg_threshold;
+    float m_variance;
+    float m_complexity_prior;
+    int m_max_modes;
+    int m_width;
+
+    // parameters in fixed point, see Prepare()
+    unsigned short m_q_alpha;
+    unsigned short m_q_decay;
+    unsigned short m_q_prune;
+    unsigned short m_q_low;
+    unsigned short m_q_high;
+    unsigned short m_q_bg;
+    unsigned short m_q_variance;
+    unsigned short m_q_max_variance;
+
+    // rounding error carried over to the next frame, see Prepare()
+    double m_alpha_error;
+    double m_decay_error;
+    double m_prune_error;
+
+    // reciprocal tables
+    float m_gain_alpha;
+    std::vector<unsigned short> m_gain_fine;
+    std::vector<unsigned short> m_gain_coarse;
+    std::vector<unsigned short> m_renorm_up;
+    std::vector<unsigned short> m_renorm_down;
+
+    GMM_PLANES m_modes;
+    cv::Mat m_modes_per_pixel;
+};
+
+}
+
+#endif
@@ -0,0 +1,683 @@
+/****************************************************************************
+*
+* GmmEngine.hpp
+*
+* Purpose: Per-pixel update of an adaptive mixture of Gaussians, shared by
+*          GrimsonGMM, ZivkovicAGMM and PoppeGMM. The three models differ
+*          only in how the modes are ordered, whether weak modes are pruned
+*          and how a pixel is matched to a mode. Those are template policies,
+*          so the kernel itself exists once:
+*
+*          OrderingPolicy - key the modes are sorted on (descending)
+*              SignificanceOrder   weight / standard deviation (Grimson, Poppe)
+*              WeightOrder         weight (Zivkovic)
+*
+*          PrunePolicy - what happens to modes that are not matched
+*              NoPrune             weight decays by (1-alpha)
+*              ComplexityPrune     Zivkovic's complexity reduction prior
+*
+*          MatchPolicy - which modes a pixel matches besides the distance test
+*              StandardMatch       none
+*              ConsistentGradualChange   Poppe's CGC test
+*
+*          The modes are stored as planes (one row per mode slot and one
+*          column per pixel), so V::WIDTH neighbouring pixels are processed
+*          at once with the wrappers from Simd.hpp. The kernels are
+*          specialised for 2..5 modes so the loops over the modes unroll,
+*          and for the storage of the planes: float, or 16 bits per value
+*          to halve the memory traffic (the arithmetic is float either way).
+*          How the slots are laid out in memory is up to the Layout policy
+*          (see GmmLayout.hpp).
+*
+******************************************************************************/
+
+#ifndef BGS_GMM_ENGINE_H_
+#define BGS_GMM_ENGINE_H_
+
+#include "Bgs.hpp"
+#include "Simd.hpp"
+#include "GmmLayout.hpp"
+
+namespace bgs
+{
+
+/////////////////////////////////////////////////////////////////////////////
+// Ordering policies
+
+// modes with a large weight and a small variance describe the background best
+struct SignificanceOrder
+{
+    template<class V>
+    static V Key(const V& weight, const V& variance) { return weight / v_sqrt(variance); }
+};
+
+// modes are ordered by weight only
+struct WeightOrder
+{
+    template<class V>
+    static V Key(const V& weight, const V&) { return weight; }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Prune policies
+
+// modes that are not matched lose weight and are only ever replaced by a new mode
+struct NoPrune
+{
+    enum { ENABLED = 0 };
+
+    float Offset(float) const { return 0.0f; }
+};
+
+// Complexity reduction prior from "Improved adaptive Gaussian mixture model for background
+// subtraction" by Z. Zivkovic. Every weight is also reduced by alpha*cT each frame and a mode
+// whose weight drops below alpha*cT is discarded.
+class ComplexityPrune
+{
+public:
+    enum { ENABLED = 1 };
+
+    ComplexityPrune() : m_complexity_prior(0.05f) {}
+
+    // This is related to the number of samples needed to accept that a component
+    // actually exists.
+    float &ComplexityPrior() { return m_complexity_prior; }
+
+    float Offset(float alpha) const { return -alpha*m_complexity_prior; }
+
+private:
+    float m_complexity_prior;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Match policies
+//
+// Pixel<V, CHANNELS> holds the policy state of V::WIDTH pixels while they are processed:
+//   Consistent(i, var)    lanes that match mode slot i no matter how far they are from it
+//   Matched(mask, i)      the lanes in mask matched slot i
+//   Swapped(i, mask)      slot i and i+1 were exchanged in the lanes in mask
+//   Replaced(mask, i)     slot i was given to a new mode in the lanes in mask
+//   Store(mask)           the lanes in mask were classified as background
+
+// a pixel matches a mode when it is within sqrt(LowThreshold) standard deviations of it
+class StandardMatch
+{
+public:
+    void Initalize(int, int) {}
+
+    template<class V, int CHANNELS>
+    class Pixel
+    {
+    public:
+        typedef typename V::Mask M;
+
+        Pixel(StandardMatch&, long, const V*) {}
+
+        M Consistent(int, const V&) const { return M::none(); }
+        void Matched(const M&, int) {}
+        void Swapped(int, const M&) {}
+        void Replaced(const M&, int) {}
+        void Store(const M&) {}
+    };
+};
+
+// Consistent gradual change from "Improved Background Mixture Models for Video Surveillance
+// Applications" by C. Poppe et al. A pixel that matched a background mode in the previous
+// frame and has moved less than cgc standard deviations since still belongs to that mode, and
+// is background, even if the mode itself has drifted away from it.
+//
+// Rather than a copy of that mode, the slot it is in is kept. The slot follows the mode while
+// the modes are sorted and is dropped once the mode is replaced, or is updated by a frame in
+// which the pixel is not background (the paper compares against the mode as it was).
+class ConsistentGradualChange
+{
+public:
+    // slot of a pixel that has no previous mode
+    enum { NONE = 255 };
+
+    ConsistentGradualChange() : m_cgc(1.8f) {}
+
+    float &Cgc() { return m_cgc; }
+
+    void Initalize(int channels, int stride)
+    {
+        // previous pixel value, one row per channel, and the slot of the mode it matched
+        m_prev_pixel = cv::Mat::zeros(channels, stride, CV_8U);
+        m_prev_slot = cv::Mat(1, stride, CV_8U, cv::Scalar(NONE));
+    }
+
+    template<class V, int CHANNELS>
+    class Pixel
+    {
+    public:
+        typedef typename V::Mask M;
+
+        Pixel(ConsistentGradualChange& policy, long posPixel, const V* pixel)
+            : m_policy(policy), m_pos(posPixel), m_pixel(pixel)
+        {
+            // squared distance the pixel moved since the previous frame
+            m_step = V::zero();
+            for(int ch = 0; ch < CHANNELS; ++ch)
+            {
+                V d = pixel[ch] - V::load_u8(m_policy.m_prev_pixel.ptr<unsigned char>(ch) + m_pos);
+                m_step = m_step + d*d;
+            }
+            m_cgc2 = V::set1(m_policy.m_cgc*m_policy.m_cgc);
+
+            m_prev = V::load_u8(m_policy.m_prev_slot.ptr<unsigned char>(0) + m_pos);
+            m_matched = V::set1((float)NONE);
+        }
+
+        M Consistent(int i, const V& var) const
+        {
+            M same = m_prev == V::set1((float)i);
+            if(!same.any())
+                return same;
+
+            return same & (m_step < m_cgc2*var);
+        }
+
+        void Matched(const M& mask, int i)
+        {
+            m_matched = v_select(mask, V::set1((float)i), m_matched);
+        }
+
+        void Swapped(int i, const M& mask)
+        {
+            m_prev = Swap(m_prev, i, mask);
+            m_matched = Swap(m_matched, i, mask);
+        }
+
+        void Replaced(const M& mask, int i)
+        {
+            m_prev = v_select(mask & (m_prev == V::set1((float)i)), V::set1((float)NONE), m_prev);
+        }
+
+        void Store(const M& mask)
+        {
+            // the previous mode changed without being recorded
+            M changed = ~mask & (m_matched == m_prev);
+            V slot = v_select(mask, m_matched, v_select(changed, V::set1((float)NONE), m_prev));
+            V::store_u8(m_policy.m_prev_slot.ptr<unsigned char>(0) + m_pos, slot);
+
+            if(!mask.any())
+                return;
+
+            for(int ch = 0; ch < CHANNELS; ++ch)
+            {
+                unsigned char* prev = m_policy.m_prev_pixel.ptr<unsigned char>(ch) + m_pos;
+                V::store_u8(prev, v_select(mask, m_pixel[ch], V::load_u8(prev)));
+            }
+        }
+
+    private:
+        static V Swap(const V& slot, int i, const M& mask)
+        {
+            V a = V::set1((float)i);
+            V b = V::set1((float)(i+1));
+            M toB = mask & (slot == a);
+            M toA = mask & (slot == b);
+            return v_select(toB, b, v_select(toA, a, slot));
+        }
+
+        ConsistentGradualChange& m_policy;
+        long m_pos;
+        const V* m_pixel;
+
+        V m_step;
+        V m_cgc2;
+        V m_prev;
+        V m_matched;
+    };
+
+private:
+    float m_cgc;
+    cv::Mat m_prev_pixel;
+    cv::Mat m_prev_slot;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Storage policies, the types the weights, variances and means of the modes are kept in
+
+struct FloatStorage
+{
+    typedef float Weight;
+    typedef float Variance;
+    typedef float Mean;
+};
+
+// Half the memory of FloatStorage. Only the weights, which lie in [0,1], are half precision.
+// Means and variances are fixed point: above 128 a half only resolves 1/8 of a grey level,
+// and between 32 and 64 1/32 of a squared one, so the small updates of a slowly adapting
+// model would be rounded away and the mean and variance would freeze. Variances are at
+// most 5*Variance(), 180 for the GMM methods, which fits Q8_8.
+struct HalfStorage
+{
+    typedef simd::Float16 Weight;
+    typedef simd::Q8_8 Variance;
+    typedef simd::Q8_8 Mean;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Engine
+
+template<class Ordering, class Prune, class Match, int CHANNELS, class Layout = DenseLayout>
+class GmmEngine
+{
+private:
+    // Structure-of-arrays storage for the mixture of Gaussians, one plane per parameter
+    // and channel. The planes are CV_32F, or CV_16U holding the 16-bit types of HalfStorage.
+    enum { VARIANCE = 0, WEIGHT = 1, MU = 2, PLANES = MU + CHANNELS };
+
+public:
+    // largest number of modes per pixel supported
+    enum { MODES_LIMIT = 16 };
+
+    GmmEngine()
+    {
+        m_alpha = 0.001f;
+        m_low_threshold = 9.0f;
+        m_high_threshold = 18.0f;
+        m_bg_threshold = 0.75f;
+        m_variance = 36.0f;
+        m_max_modes = 0;
+        m_half_float = false;
+    }
+
+    // alpha - speed of update - if the time interval you want to average over is T
+    // set alpha=1/T.
+    float &Alpha() { return m_alpha; }
+
+    // squared Mahalanobis distance a pixel must be within to match a mode (low), or to be
+    // considered background by the high threshold mask
+    float &LowThreshold() { return m_low_threshold; }
+    float &HighThreshold() { return m_high_threshold; }
+
+    // Threshold when the component becomes significant enough to be included into
+    // the background model. It is the TB = 1-cf from the paper.
+    float &BgThreshold() { return m_bg_threshold; }
+
+    // Initial variance for the newly generated components.
+    // It will will influence the speed of adaptation. A good guess should be made.
+    // A simple way is to estimate the typical standard deviation from the images.
+    float &Variance() { return m_variance; }
+
+    // Store the model with 16 bits per value (see HalfStorage). Takes effect at the next
+    // Initalize().
+    bool &HalfFloat() { return m_half_float; }
+
+    Prune &PrunePolicy() { return m_prune; }
+    Match &MatchPolicy() { return m_match; }
+
+    // Allocate an empty model for width x height pixels with up to max_modes modes each.
+    void Initalize(int width, int height, int max_modes)
+    {
+        if(max_modes < 1 || max_modes > MODES_LIMIT)
+            CV_Error( CV_StsOutOfRange, "The number of modes per pixel must be between 1 and 16" );
+
+        m_width = width;
+        m_max_modes = max_modes;
+
+        // GMM for each pixel
+        m_layout.Initalize(width, height, max_modes, PLANES, m_half_float ? CV_16U : CV_32F);
+
+        // used modes per pixel
+        m_modes_per_pixel = cv::Mat::zeros(height, width, CV_8U);
+
+        m_match.Initalize(CHANNELS, (width*height + 15) & ~15);
+    }
+
+    // Update the model with rows [row_begin, row_end) of image and write the masks for those
+    // rows. Disjoint ranges of rows may be processed concurrently.
+    void SubtractRows(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask,
+                      int row_begin, int row_end)
+    {
+        if(m_layout.Type() == CV_16U)
+            SubtractRowsAs<HalfStorage>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end);
+        else
+            SubtractRowsAs<FloatStorage>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end);
+    }
+
+    // Write rows [row_begin, row_end) of the background image, the mean of the first mode of each
+    // pixel. Disjoint ranges of rows may be processed concurrently.
+    void BackgroundRows(cv::Mat& background, int row_begin, int row_end)
+    {
+        if(m_layout.Type() == CV_16U)
+            BackgroundRowsAs<HalfStorage>(background, row_begin, row_end);
+        else
+            BackgroundRowsAs<FloatStorage>(background, row_begin, row_end);
+    }
+
+    // Let the layout give back the memory of modes that have been pruned. Must not run
+    // concurrently with SubtractRows() or BackgroundRows().
+    void Compact()
+    {
+        m_layout.Compact(m_modes_per_pixel);
+    }
+
+private:
+    template<class S>
+    void SubtractRowsAs(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask,
+                      int row_begin, int row_end)
+    {
+        switch(m_max_modes)
+        {
+        case 2: SubtractRange<S, 2>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        case 3: SubtractRange<S, 3>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        case 4: SubtractRange<S, 4>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        case 5: SubtractRange<S, 5>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        default: SubtractRange<S, 0>(image, low_threshold_mask, high_threshold_mask, row_begin, row_end); break;
+        }
+    }
+
+    template<class S>
+    void BackgroundRowsAs(cv::Mat& background, int row_begin, int row_end)
+    {
+        typedef typename S::Mean TM;
+
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            unsigned char* pBackground = background.ptr<unsigned char>(r);
+            typename Layout::Cursor slots(m_layout, r, 0);
+            for(int ch = 0; ch < CHANNELS; ++ch)
+            {
+                const TM* mu = slots.template Slot<TM>(MU+ch, 0);
+                for(int c = 0; c < m_width; ++c)
+                    pBackground[CHANNELS*c+ch] = (unsigned char)simd::VFloat1::load(mu+c).v;
+            }
+        }
+    }
+
+    // S is the storage policy of the planes. MAX_MODES > 0 fixes the number of modes at compile
+    // time, 0 uses m_max_modes.
+    template<class S, int MAX_MODES>
+    void SubtractRange(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask,
+                       int row_begin, int row_end)
+    {
+        const int step = simd::VFloat::WIDTH;
+
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const unsigned char* pixels = image.ptr<unsigned char>(r);
+            unsigned char* numModes = m_modes_per_pixel.ptr<unsigned char>(r);
+            unsigned char* low = low_threshold_mask.ptr<unsigned char>(r);
+            unsigned char* high = high_threshold_mask.ptr<unsigned char>(r);
+
+            // update model + background subtract, as many pixels at a time as the
+            // vector unit allows and the remainder of the row one by one
+            int c = 0;
+            for(; c + step <= m_width; c += step)
+                SubtractPixels<simd::VFloat, S, MAX_MODES>(r, c, pixels+CHANNELS*c, numModes+c, low+c, high+c);
+            for(; c < m_width; ++c)
+                SubtractPixels<simd::VFloat1, S, MAX_MODES>(r, c, pixels+CHANNELS*c, numModes+c, low+c, high+c);
+        }
+    }
+
+    // Exchange slot i and i+1 of a plane in the lanes set in swap.
+    template<class V, class T>
+    static void SwapSlots(const typename Layout::Cursor& slots, int plane, int i, const typename V::Mask& swap)
+    {
+        T* a = slots.template Slot<T>(plane, i);
+        T* b = slots.template Slot<T>(plane, i+1);
+        V va = V::load(a);
+        V vb = V::load(b);
+        V::store(a, v_select(swap, vb, va));
+        V::store(b, v_select(swap, va, vb));
+    }
+
+    // Sort the first nModes modes of each lane in descending order of the ordering key using an
+    // odd-even transposition network. Like the insertion sort std::sort falls back to for short
+    // ranges it is stable, so modes with equal keys keep their order.
+    template<class V, class S, int MAX_MODES>
+    void SortModes(const typename Layout::Cursor& slots, const V& nModes, typename Match::template Pixel<V, CHANNELS>& match)
+    {
+        typedef typename S::Weight TW;
+        typedef typename S::Variance TV;
+        typedef typename S::Mean TM;
+        typedef typename V::Mask M;
+
+        const int maxModes = MAX_MODES > 0 ? MAX_MODES : m_max_modes;
+
+        // slots no lane uses are never swapped, so they are not loaded either
+        V keys[MAX_MODES > 0 ? MAX_MODES : MODES_LIMIT];
+        for(int i = 0; i < maxModes; ++i)
+        {
+            if((V::set1((float)i) < nModes).any())
+                keys[i] = Ordering::Key(V::load(slots.template Slot<TW>(WEIGHT, i)), V::load(slots.template Slot<TV>(VARIANCE, i)));
+            else
+                keys[i] = V::zero();
+        }
+
+        for(int pass = 0; pass < maxModes; ++pass)
+        {
+            for(int i = pass & 1; i+1 < maxModes; i += 2)
+            {
+                M swap = (V::set1((float)(i+1)) < nModes) & (keys[i+1] > keys[i]);
+                if(!swap.any())
+                    continue;
+
+                V ka = keys[i];
+                V kb = keys[i+1];
+                keys[i] = v_select(swap, kb, ka);
+                keys[i+1] = v_select(swap, ka, kb);
+
+                SwapSlots<V, TV>(slots, VARIANCE, i, swap);
+                SwapSlots<V, TW>(slots, WEIGHT, i, swap);
+                for(int ch = 0; ch < CHANNELS; ++ch)
+                    SwapSlots<V, TM>(slots, MU+ch, i, swap);
+                match.Swapped(i, swap);
+            }
+        }
+    }
+
+    // Processes V::WIDTH neighbouring pixels starting at row r, column c. Lanes that take a different
+    // branch are masked out instead of skipped, so the result does not depend on the vector width.
+    template<class V, class S, int MAX_MODES>
+    void SubtractPixels(int r, int c, const unsigned char* pixels, unsigned char* numModes, unsigned char* low_threshold, unsigned char* high_threshold)
+    {
+        typedef typename S::Weight TW;
+        typedef typename S::Variance TV;
+        typedef typename S::Mean TM;
+        typedef typename V::Mask M;
+
+        const int maxModes = MAX_MODES > 0 ? MAX_MODES : m_max_modes;
+        const V zero = V::zero();
+        const V one = V::set1(1.0f);
+        const V alpha = V::set1(m_alpha);
+        const V oneMinAlpha = V::set1(1-m_alpha);
+        const V prune = V::set1(m_prune.Offset(m_alpha));
+        const V minWeight = V::set1(-m_prune.Offset(m_alpha));
+        const V lowThreshold = V::set1(m_low_threshold);
+        const V highThreshold = V::set1(m_high_threshold);
+        const V bgThreshold = V::set1(m_bg_threshold);
+        const V minVariance = V::set1(4.0f);
+        const V maxVariance = V::set1(5*m_variance);
+
+        V pixel[CHANNELS];
+        for(int ch = 0; ch < CHANNELS; ++ch)
+            pixel[ch] = V::load_u8(pixels+ch, CHANNELS);
+
+        V nModes = V::load_u8(numModes);
+
+        typename Layout::Cursor slots(m_layout, r, c);
+
+        long posPixel = (long)r*m_width + c;
+        typename Match::template Pixel<V, CHANNELS> match(m_match, posPixel, pixel);
+
+        M bFitsPDF = M::none();
+        M bBackgroundLow = M::none();
+        M bBackgroundHigh = M::none();
+
+        // sum of the weights of the modes in front of the current one; a mode is part of the
+        // background model as long as this is below the background threshold
+        V sum = zero;
+        V totalWeight = zero;
+
+        // update all distributions and check for match with current pixel
+        for(int iModes = 0; iModes < maxModes; ++iModes)
+        {
+            // pruning may reduce the number of modes while the loop runs
+            M active = V::set1((float)iModes) < nModes;
+            if(!active.any())
+                break;
+
+            TV* pVar = slots.template Slot<TV>(VARIANCE, iModes);
+            TW* pWeight = slots.template Slot<TW>(WEIGHT, iModes);
+            V var = V::load(pVar);
+            V weight = V::load(pWeight);
+
+            M background = active & (sum < bgThreshold);
+            sum = sum + v_select(active, weight, zero);
+
+            // calculate the squared distance
+            V mu[CHANNELS];
+            V d[CHANNELS];
+            V dist = zero;
+            for(int ch = 0; ch < CHANNELS; ++ch)
+            {
+                mu[ch] = V::load(slots.template Slot<TM>(MU+ch, iModes));
+                d[ch] = mu[ch] - pixel[ch];
+                dist = dist + d[ch]*d[ch];
+            }
+
+            // only lanes for which a fit has not been found yet are checked
+            M check = active & ~bFitsPDF;
+            M consistent = check & match.Consistent(iModes, var);
+            bBackgroundHigh = bBackgroundHigh | (check & background & (dist < highThreshold*var)) | consistent;
+
+            // a match occurs when the pixel is within sqrt(fTg) standard deviations of the distribution
+            M matched = consistent | (check & (dist < lowThreshold*var));
+            bBackgroundLow = bBackgroundLow | (matched & background) | consistent;
+            bFitsPDF = bFitsPDF | matched;
+
+            // update matched distributions, all other distributions only lose weight
+            V k = alpha / weight;
+            V decayed = oneMinAlpha*weight;
+            if(Prune::ENABLED)
+                decayed = decayed + prune;
+            V newWeight = v_select(matched, decayed + alpha, decayed);
+
+            if(Prune::ENABLED)
+            {
+                // discard modes that became too weak
+                M pruned = active & ~matched & (decayed < minWeight);
+                newWeight = v_select(pruned, zero, newWeight);
+                nModes = v_select(pruned, nModes - one, nModes);
+            }
+
+            //limit the variance
+            V sigmanew = v_min(v_max(var + k*(dist-var), minVariance), maxVariance);
+            var = v_select(matched, sigmanew, var);
+
+            V::store(pWeight, v_select(active, newWeight, weight));
+            V::store(pVar, var);
+            for(int ch = 0; ch < CHANNELS; ++ch)
+                V::store(slots.template Slot<TM>(MU+ch, iModes), v_select(matched, mu[ch] - k*d[ch], mu[ch]));
+            match.Matched(matched, iModes);
+
+            totalWeight = totalWeight + v_select(active, newWeight, zero);
+        }
+
+        // renormalize weights so they add to one
+        V invTotalWeight = one / totalWeight;
+        for(int iLocal = 0; iLocal < maxModes; ++iLocal)
+        {
+            M active = V::set1((float)iLocal) < nModes;
+            if(!active.any())
+                break;
+
+            TW* pWeight = slots.template Slot<TW>(WEIGHT, iLocal);
+            V weight = V::load(pWeight);
+            V::store(pWeight, v_select(active, weight*invTotalWeight, weight));
+        }
+
+        // Sort modes so they are in desending order.
+        SortModes<V, S, MAX_MODES>(slots, nModes, match);
+
+        // make new mode if needed and exit
+        M create = ~bFitsPDF;
+        if(create.any())
+        {
+            // the weakest mode will be replaced if all modes are in use
+            V maxModesV = V::set1((float)maxModes);
+            V newModes = v_select(create, v_min(nModes + one, maxModesV), nModes);
+            V newWeight = v_select(newModes == one, one, alpha);
+            V newVariance = V::set1(m_variance);
+
+            if((create & (newModes > one)).any())
+                slots.ReserveExtraModes();
+
+            V total = zero;
+            for(int iLocal = 0; iLocal < maxModes; ++iLocal)
+            {
+                V slot = V::set1((float)iLocal);
+                M active = slot < newModes;
+                if(!active.any())
+                    break;
+
+                M target = create & (slot == newModes - one);
+                TW* pWeight = slots.template Slot<TW>(WEIGHT, iLocal);
+                TV* pVar = slots.template Slot<TV>(VARIANCE, iLocal);
+
+                V weight = v_select(target, newWeight, V::load(pWeight));
+                V::store(pWeight, weight);
+                V::store(pVar, v_select(target, newVariance, V::load(pVar)));
+                for(int ch = 0; ch < CHANNELS; ++ch)
+                {
+                    TM* pMu = slots.template Slot<TM>(MU+ch, iLocal);
+                    V::store(pMu, v_select(target, pixel[ch], V::load(pMu)));
+                }
+                match.Replaced(target, iLocal);
+
+                total = total + v_select(active, weight, zero);
+            }
+
+            //renormalize weights
+            V invSum = one / total;
+            for(int iLocal = 0; iLocal < maxModes; ++iLocal)
+            {
+                M active = create & (V::set1((float)iLocal) < newModes);
+                if(!active.any())
+                    break;
+
+                TW* pWeight = slots.template Slot<TW>(WEIGHT, iLocal);
+                V weight = V::load(pWeight);
+                V::store(pWeight, v_select(active, weight*invSum, weight));
+            }
+
+            nModes = newModes;
+
+            // Sort modes so they are in desending order.
+            SortModes<V, S, MAX_MODES>(slots, nModes, match);
+        }
+
+        match.Store(bFitsPDF & bBackgroundLow);
+
+        V::store_u8(numModes, nModes);
+        v_store_mask_u8(low_threshold, bBackgroundLow, Bgs::BACKGROUND, Bgs::FOREGROUND);
+        v_store_mask_u8(high_threshold, bBackgroundHigh, Bgs::BACKGROUND, Bgs::FOREGROUND);
+    }
+
+    // mixture parameters
+    float m_alpha;
+    float m_low_threshold;
+    float m_high_threshold;
+    float m_bg_threshold;
+    float m_variance;
+    int m_max_modes;
+    int m_width;
+    bool m_half_float;
+
+    Prune m_prune;
+    Match m_match;
+
+    // Mixture of Gaussians for every pixel
+    Layout m_layout;
+
+    // Number of Gaussian components per pixel
+    cv::Mat m_modes_per_pixel;
+};
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "GmmLayout.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+using namespace bgs;
+
+/////////////////////////////////////////////////////////////////////////////
+// DenseLayout
+
+void DenseLayout::Initalize(int width, int height, int max_modes, int planes, int type)
+{
+    m_width = width;
+    m_max_modes = max_modes;
+
+    // one padded row per plane and mode slot
+    int stride = (width*height + 15) & ~15;
+    m_planes = cv::Mat::zeros(planes*max_modes, stride, type);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CompactLayout
+
+CompactLayout::CompactLayout()
+{
+    m_width = 0;
+    m_groups_per_row = 0;
+    m_planes = 0;
+    m_block_bytes = 0;
+    m_chunk_blocks = 0;
+    m_chunk_used = 0;
+}
+
+CompactLayout::~CompactLayout()
+{
+    Release();
+}
+
+void CompactLayout::Initalize(int width, int height, int max_modes, int planes, int type)
+{
+    Release();
+
+    m_width = width;
+    m_groups_per_row = (width + GROUP - 1) / GROUP;
+    m_planes = planes;
+
+    int stride = (width*height + 15) & ~15;
+    m_first = cv::Mat::zeros(planes, stride, type);
+
+    m_blocks.assign(m_groups_per_row*height, (unsigned char*)0);
+
+    // the pool grows a row's worth of groups at a time
+    m_block_bytes = (size_t)(max_modes-1)*planes*GROUP*m_first.elemSize();
+    m_chunk_blocks = m_groups_per_row;
+    m_chunk_used = m_chunk_blocks;
+}
+
+unsigned char* CompactLayout::Allocate()
+{
+    std::lock_guard<std::mutex> lock(m_pool_mutex);
+
+    if(m_chunk_used == m_chunk_blocks)
+    {
+        m_chunks.push_back(new unsigned char[m_chunk_blocks*m_block_bytes]);
+        m_chunk_used = 0;
+    }
+
+    unsigned char* block = m_chunks.back() + m_chunk_used*m_block_bytes;
+    m_chunk_used++;
+
+    memset(block, 0, m_block_bytes);
+    return block;
+}
+
+void CompactLayout::Release()
+{
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+        delete [] m_chunks[i];
+    m_chunks.clear();
+    m_chunk_used = m_chunk_blocks;
+}
+
+void CompactLayout::Compact(const cv::Mat& modes_per_pixel)
+{
+    std::vector<unsigned char*> old_chunks;
+    old_chunks.swap(m_chunks);
+    m_chunk_used = m_chunk_blocks;
+
+    for(int r = 0; r < modes_per_pixel.rows; ++r)
+    {
+        const unsigned char* numModes = modes_per_pixel.ptr<unsigned char>(r);
+        for(int g = 0; g < m_groups_per_row; ++g)
+        {
+            unsigned char*& block = m_blocks[r*m_groups_per_row + g];
+            if(!block)
+                continue;
+
+            int c_end = std::min((g+1)*GROUP, m_width);
+            bool used = false;
+            for(int c = g*GROUP; c < c_end && !used; ++c)
+                used = numModes[c] > 1;
+
+            if(used)
+            {
+                unsigned char* packed = Allocate();
+                memcpy(packed, block, m_block_bytes);
+                block = packed;
+            }
+            else
+            {
+                block = 0;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < old_chunks.size(); ++i)
+        delete [] old_chunks[i];
+}
+
+size_t CompactLayout::Bytes() const
+{
+    return m_first.total()*m_first.elemSize() + m_blocks.size()*sizeof(unsigned char*) +
+           m_chunks.size()*m_chunk_blocks*m_block_bytes;
+}
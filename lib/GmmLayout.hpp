@@ -0,0 +1,175 @@
+/****************************************************************************
+*
+* GmmLayout.hpp
+*
+* Purpose: Memory layouts for the mode planes of GmmEngine. A layout owns
+*          the planes (variance, weight and one mean per channel). The
+*          engine opens a Cursor on the pixels it is about to process and
+*          asks it for the value of plane p in mode slot i. It only asks for
+*          slots a pixel of the vector actually uses, and calls
+*          ReserveExtraModes() before one of them gets a second mode, so a
+*          layout need not provide the other slots.
+*
+*          DenseLayout     MaxModes slots for every pixel
+*          CompactLayout   the first slot of every pixel is dense, the
+*                          other slots are only allocated for the pixels
+*                          that need them, so memory and memory traffic
+*                          follow the number of modes the scene needs
+*
+******************************************************************************/
+
+#ifndef BGS_GMM_LAYOUT_H_
+#define BGS_GMM_LAYOUT_H_
+
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace bgs
+{
+
+// One padded row per plane and mode slot and one column per pixel. Rows are padded to
+// a multiple of 16 values so every slot starts on an aligned boundary and neighbouring
+// pixels can be loaded into a single SIMD register.
+class DenseLayout
+{
+public:
+    DenseLayout() : m_width(0), m_max_modes(0) {}
+
+    // Allocate zeroed planes of the given type for width x height pixels.
+    void Initalize(int width, int height, int max_modes, int planes, int type);
+
+    int Type() const { return m_planes.empty() ? CV_32F : m_planes.type(); }
+
+    // every pixel keeps all its slots
+    void Compact(const cv::Mat&) {}
+
+    size_t Bytes() const { return m_planes.total()*m_planes.elemSize(); }
+
+    // slots of the pixels from row r, column c on
+    class Cursor
+    {
+    public:
+        Cursor(DenseLayout& layout, int r, int c)
+            : m_base(layout.m_planes.data + ((long)r*layout.m_width + c)*layout.m_planes.elemSize()),
+              m_step(layout.m_planes.step[0]), m_max_modes(layout.m_max_modes) {}
+
+        void ReserveExtraModes() {}
+
+        template<class T>
+        T* Slot(int plane, int i) const
+        {
+            return (T*)(m_base + (plane*m_max_modes + i)*m_step);
+        }
+
+    private:
+        unsigned char* m_base;
+        size_t m_step;
+        int m_max_modes;
+    };
+
+private:
+    int m_width;
+    int m_max_modes;
+
+    // row plane*max_modes + i holds slot i of a plane
+    cv::Mat m_planes;
+};
+
+// The pixels of a row are split into groups of GROUP. Slot 0 of all pixels is kept in
+// dense planes like DenseLayout. The other slots of a group live in a block that is
+// allocated from a pool the first time one of its pixels needs a second mode; within
+// the block the values are planar again, so a vector of neighbouring pixels still maps
+// to consecutive values. Compact() returns the blocks of groups that are back to one
+// mode per pixel.
+class CompactLayout
+{
+public:
+    // the widest vector, so a vector never spans two groups
+    enum { GROUP = 8 };
+
+    CompactLayout();
+    ~CompactLayout();
+
+    void Initalize(int width, int height, int max_modes, int planes, int type);
+
+    int Type() const { return m_first.empty() ? CV_32F : m_first.type(); }
+
+    // Release the blocks of groups in which no pixel has more than one mode and pack the
+    // remaining ones into fresh memory, in the order of the groups. Must not run while the
+    // model is being updated.
+    void Compact(const cv::Mat& modes_per_pixel);
+
+    size_t Bytes() const;
+
+    // Slots of the pixels from row r, column c on. Cursors on disjoint rows may be used
+    // concurrently.
+    class Cursor
+    {
+    public:
+        Cursor(CompactLayout& layout, int r, int c)
+            : m_layout(layout),
+              m_first(layout.m_first.data + ((long)r*layout.m_width + c)*layout.m_first.elemSize()),
+              m_first_step(layout.m_first.step[0]),
+              m_block(&layout.m_blocks[r*layout.m_groups_per_row + c/GROUP]),
+              m_extra(*m_block),
+              m_plane_step(GROUP*layout.m_first.elemSize()),
+              m_slot_step(layout.m_planes*m_plane_step),
+              m_lane(c%GROUP) {}
+
+        // the group gets its block when one of its pixels is about to get a second mode
+        void ReserveExtraModes()
+        {
+            if(!m_extra)
+                m_extra = *m_block = m_layout.Allocate();
+        }
+
+        template<class T>
+        T* Slot(int plane, int i) const
+        {
+            if(i == 0)
+                return (T*)(m_first + plane*m_first_step);
+            return (T*)(m_extra + (i-1)*m_slot_step + plane*m_plane_step) + m_lane;
+        }
+
+    private:
+        CompactLayout& m_layout;
+        unsigned char* m_first;
+        size_t m_first_step;
+        unsigned char** m_block;
+        unsigned char* m_extra;
+        size_t m_plane_step;
+        size_t m_slot_step;
+        int m_lane;
+    };
+
+private:
+    CompactLayout(const CompactLayout&);
+    CompactLayout& operator=(const CompactLayout&);
+
+    // zeroed block for the extra slots of one group, thread-safe
+    unsigned char* Allocate();
+    void Release();
+
+    int m_width;
+    int m_groups_per_row;
+    int m_planes;
+
+    // slot 0 of every pixel, one row per plane
+    cv::Mat m_first;
+
+    // block of each group, 0 while its pixels have a single mode
+    std::vector<unsigned char*> m_blocks;
+
+    // the pool blocks are carved from; chunks never move so blocks stay valid while it grows
+    std::mutex m_pool_mutex;
+    std::vector<unsigned char*> m_chunks;
+    size_t m_block_bytes;
+    int m_chunk_blocks;
+    int m_chunk_used;
+};
+
+}
+
+#endif
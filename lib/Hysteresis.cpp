@@ -0,0 +1,209 @@
+#include "Hysteresis.hpp"
+#include "Bgs.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+using namespace bgs;
+
+namespace
+{
+
+// values of the output while the connected rule runs
+const unsigned char UNVISITED = 1;
+
+}
+
+void Hysteresis::Apply(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output)
+{
+    if(low_mask.type() != CV_8U || high_mask.type() != CV_8U || low_mask.size() != high_mask.size())
+        CV_Error( CV_StsUnmatchedFormats, "Hysteresis needs two 8-bit masks of the same size" );
+
+    // both rules read the neighbours of a pixel after its row of the output has been written
+    bool aliased = output.data == low_mask.data || output.data == high_mask.data;
+    cv::Mat& result = aliased ? m_result : output;
+    result.create(low_mask.rows, low_mask.cols, CV_8U);
+
+    if(m_mode == CONNECTED)
+        Connected(low_mask, high_mask, result);
+    else
+        Neighbours(low_mask, high_mask, result);
+
+    if(m_clear_border && result.rows > 0 && result.cols > 0)
+    {
+        for(int r = 0; r < result.rows; ++r)
+        {
+            result.at<unsigned char>(r, 0) = Bgs::BACKGROUND;
+            result.at<unsigned char>(r, result.cols-1) = Bgs::BACKGROUND;
+        }
+        memset(result.ptr<unsigned char>(0), Bgs::BACKGROUND, result.cols);
+        memset(result.ptr<unsigned char>(result.rows-1), Bgs::BACKGROUND, result.cols);
+    }
+
+    if(aliased)
+        result.copyTo(output);
+}
+
+// output = high | (low & dilate(high)) with a 3x3 square, normalised to 0/255. Each row ORs
+// the three rows of the high mask around it into a padded buffer and then ORs that with
+// itself shifted a pixel left and right.
+void Hysteresis::Neighbours(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output)
+{
+    typedef simd::VU8 V;
+    typedef simd::VU8x1 V1;
+
+    const int rows = low_mask.rows;
+    const int cols = low_mask.cols;
+
+    ParallelRows(rows, m_threads, [&](int row_begin, int row_end)
+    {
+        // high mask ORed over three rows, with a background pixel on either side
+        std::vector<unsigned char> buffer(cols + 2, 0);
+        unsigned char* column = &buffer[1];
+
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const unsigned char* above = high_mask.ptr<unsigned char>(std::max(r-1, 0));
+            const unsigned char* high = high_mask.ptr<unsigned char>(r);
+            const unsigned char* below = high_mask.ptr<unsigned char>(std::min(r+1, rows-1));
+            const unsigned char* low = low_mask.ptr<unsigned char>(r);
+            unsigned char* out = output.ptr<unsigned char>(r);
+
+            int c = 0;
+            for(; c + V::WIDTH <= cols; c += V::WIDTH)
+                V::store(column+c, V::load(above+c) | V::load(high+c) | V::load(below+c));
+            for(; c < cols; ++c)
+                column[c] = above[c] | high[c] | below[c];
+
+            const V zero = V::zero();
+            c = 0;
+            for(; c + V::WIDTH <= cols; c += V::WIDTH)
+            {
+                V dilated = V::load(column+c-1) | V::load(column+c) | V::load(column+c+1);
+                V fg = V::load(high+c) | (V::load(low+c) & dilated);
+                V::store(out+c, (fg == zero) == zero);
+            }
+            for(; c < cols; ++c)
+            {
+                V1 dilated = V1::load(column+c-1) | V1::load(column+c) | V1::load(column+c+1);
+                V1 fg = V1::load(high+c) | (V1::load(low+c) & dilated);
+                V1::store(out+c, (fg == V1::zero()) == V1::zero());
+            }
+        }
+    });
+}
+
+// Mark the pixels of low | high as UNVISITED, flood fill them with FOREGROUND from every pixel
+// of the high mask and clear what the fills did not reach.
+void Hysteresis::Connected(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output)
+{
+    typedef simd::VU8 V;
+
+    const int rows = low_mask.rows;
+    const int cols = low_mask.cols;
+
+    ParallelRows(rows, m_threads, [&](int row_begin, int row_end)
+    {
+        const V zero = V::zero();
+        const V unvisited = V::set1(UNVISITED);
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const unsigned char* low = low_mask.ptr<unsigned char>(r);
+            const unsigned char* high = high_mask.ptr<unsigned char>(r);
+            unsigned char* out = output.ptr<unsigned char>(r);
+
+            int c = 0;
+            for(; c + V::WIDTH <= cols; c += V::WIDTH)
+                V::store(out+c, (((V::load(low+c) | V::load(high+c)) == zero) == zero) & unvisited);
+            for(; c < cols; ++c)
+                out[c] = (low[c] | high[c]) ? UNVISITED : 0;
+        }
+    });
+
+    // the fills cross any split of the rows, so they run on this thread
+    for(int r = 0; r < rows; ++r)
+    {
+        const unsigned char* high = high_mask.ptr<unsigned char>(r);
+        const unsigned char* out = output.ptr<unsigned char>(r);
+
+        int c = 0;
+        while(c < cols)
+        {
+            // skip runs without a seed
+            if(c + V::WIDTH <= cols && !simd::v_any(V::load(high+c)))
+            {
+                c += V::WIDTH;
+                continue;
+            }
+            if(high[c] && out[c] == UNVISITED)
+                Fill(output, r, c);
+            ++c;
+        }
+    }
+
+    ParallelRows(rows, m_threads, [&](int row_begin, int row_end)
+    {
+        const V foreground = V::set1(Bgs::FOREGROUND);
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            unsigned char* out = output.ptr<unsigned char>(r);
+
+            int c = 0;
+            for(; c + V::WIDTH <= cols; c += V::WIDTH)
+                V::store(out+c, V::load(out+c) == foreground);
+            for(; c < cols; ++c)
+                out[c] = (out[c] == Bgs::FOREGROUND) ? Bgs::FOREGROUND : Bgs::BACKGROUND;
+        }
+    });
+}
+
+// Scanline flood fill of the UNVISITED pixels 8-connected to (r, c). Each span is filled
+// whole, and the rows above and below are searched from one pixel before it to one pixel
+// after it for the start of each unvisited run, which is pushed as a new seed.
+void Hysteresis::Fill(cv::Mat& output, int r, int c)
+{
+    const int rows = output.rows;
+    const int cols = output.cols;
+
+    m_stack.clear();
+    m_stack.push_back(cv::Point(c, r));
+
+    while(!m_stack.empty())
+    {
+        cv::Point seed = m_stack.back();
+        m_stack.pop_back();
+
+        unsigned char* out = output.ptr<unsigned char>(seed.y);
+        if(out[seed.x] != UNVISITED)
+            continue;
+
+        int left = seed.x;
+        while(left > 0 && out[left-1] == UNVISITED)
+            left--;
+        int right = seed.x;
+        while(right+1 < cols && out[right+1] == UNVISITED)
+            right++;
+        memset(out + left, Bgs::FOREGROUND, right - left + 1);
+
+        const int begin = std::max(left-1, 0);
+        const int end = std::min(right+1, cols-1);
+        for(int y = seed.y-1; y <= seed.y+1; y += 2)
+        {
+            if(y < 0 || y >= rows)
+                continue;
+
+            const unsigned char* next = output.ptr<unsigned char>(y);
+            for(int x = begin; x <= end; ++x)
+            {
+                if(next[x] != UNVISITED)
+                    continue;
+                m_stack.push_back(cv::Point(x, y));
+                while(x+1 <= end && next[x+1] == UNVISITED)
+                    x++;
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+*
+* Hysteresis.hpp
+*
+* Purpose: Combines the low and high threshold masks that every Bgs::Subtract
+*          produces into one foreground mask. A pixel is foreground if it is
+*          in the high mask, or if it is in the low mask and
+*
+*          NEIGHBOURS: one of its 8 neighbours is in the high mask, the rule
+*                      used by Cucchiara et al and PratiMediod
+*          CONNECTED:  it is 8-connected to a pixel of the high mask through
+*                      pixels of the low mask, so a whole object is kept as
+*                      soon as part of it passes the high threshold
+*
+*          The neighbour rule is a 3x3 dilation of the high mask done a
+*          vector of pixels at a time. The connected rule grows the high
+*          mask into the low one with a scanline flood fill, which visits
+*          each foreground pixel about once.
+*
+******************************************************************************/
+
+#ifndef BGS_HYSTERESIS_H_
+#define BGS_HYSTERESIS_H_
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+namespace bgs
+{
+
+class Hysteresis
+{
+public:
+    enum Mode
+    {
+        NEIGHBOURS,
+        CONNECTED
+    };
+
+    Hysteresis(Mode mode = NEIGHBOURS)
+    {
+        m_mode = mode;
+        m_clear_border = false;
+        m_threads = 0;
+    }
+
+    Mode &Connectivity() { return m_mode; }
+
+    // Leave the pixels on the edge of the frame as background.
+    bool &ClearBorder() { return m_clear_border; }
+
+    // Number of threads the vectorised passes may use, 0 for all cores and 1 to run serially.
+    unsigned int &Threads() { return m_threads; }
+
+    // Combine two CV_8U masks of the same size, where any value other than 0 is foreground, into
+    // a 0/255 mask. 'output' may be one of the inputs.
+    void Apply(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output);
+
+private:
+    void Neighbours(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output);
+    void Connected(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output);
+    void Fill(cv::Mat& output, int r, int c);
+
+    Mode m_mode;
+    bool m_clear_border;
+    unsigned int m_threads;
+
+    // result when the output is one of the inputs
+    cv::Mat m_result;
+    // spans still to be filled
+    std::vector<cv::Point> m_stack;
+};
+
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "Mean.hpp"
+#include "Simd.hpp"
 
 using namespace bgs;
 
@@ -27,8 +28,19 @@ void Mean::Initalize(const cv::Mat& image)
     m_params.SetFrameSize(image.cols, image.rows);
     m_params.Channels() = image.channels();
 
-    m_mean = image.clone();
-    m_background = cv::Mat(m_params.Height(), m_params.Width(), image.type());
+    const int channels = m_params.Channels();
+    m_mean.create(m_params.Height()*channels, m_params.Width(), CV_32F);
+    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    {
+        const unsigned char* pixels = image.ptr<unsigned char>(r);
+        for(int ch = 0; ch < channels; ++ch)
+        {
+            float* mean = m_mean.ptr<float>(r*channels + ch);
+            for(unsigned int c = 0; c < m_params.Width(); ++c)
+                mean[c] = pixels[c*channels + ch];
+        }
+    }
+    m_background = image.clone();
 }
 
 void Mean::Save(std::string file)
@@ -41,6 +53,50 @@ void Mean::Load(std::string file)
 
 }
 
+namespace
+{
+
+// Squared distance between the pixels and the mean over the channels, compared against
+// both thresholds.
+template<class V, int CHANNELS>
+void SubtractPixels(const unsigned char* pixels, const float* const* mean, int c, unsigned char* low,
+                    unsigned char* high, const V& low_threshold, const V& high_threshold)
+{
+    V dist = V::zero();
+    for(int ch = 0; ch < CHANNELS; ++ch)
+    {
+        V diff = V::load_u8(pixels + ch, CHANNELS) - V::load(mean[ch] + c);
+        dist = dist + diff*diff;
+    }
+
+    v_store_mask_u8(low, dist > low_threshold, Bgs::FOREGROUND, Bgs::BACKGROUND);
+    v_store_mask_u8(high, dist > high_threshold, Bgs::FOREGROUND, Bgs::BACKGROUND);
+}
+
+// mean + (1 - alpha)*(pixel - mean) where the pixel is updated, and the background rounded
+// from the result in the same pass
+template<class V, int CHANNELS>
+void UpdatePixels(const unsigned char* pixels, float* const* mean, int c, const unsigned char* mask,
+                  unsigned char* background, const V& rate, bool learning)
+{
+    typedef typename V::Mask M;
+
+    M update = learning ? ~M::none() : (V::load_u8(mask) == V::set1(Bgs::BACKGROUND));
+    if(!update.any())
+        return;
+
+    const V half = V::set1(0.5f);
+    for(int ch = 0; ch < CHANNELS; ++ch)
+    {
+        V m = V::load(mean[ch] + c);
+        m = v_select(update, m + rate*(V::load_u8(pixels + ch, CHANNELS) - m), m);
+        V::store(mean[ch] + c, m);
+        V::store_u8(background + ch, m + half, CHANNELS);
+    }
+}
+
+}
+
 void Mean::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
     if(m_frame_num == 0)
@@ -52,100 +108,85 @@ void Mean::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat&
     if(high_threshold_mask.empty())
         high_threshold_mask.create(m_params.Height(), m_params.Width(), CV_8U);
 
-    unsigned char low_threshold, high_threshold;
-
-    // update each pixel of the image
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    // compare each pixel of the image with the mean, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // perform background subtraction + update background model
             if(m_params.Channels() == 3)
-                SubtractPixel(r, c, image.at<cv::Vec3b>(r,c), low_threshold, high_threshold);
+                SubtractRow<3>(r, image, low_threshold_mask, high_threshold_mask);
             else
-                SubtractPixel(r, c, image.at<unsigned char>(r,c), low_threshold, high_threshold);
-
-            // setup silhouette mask
-            low_threshold_mask.at<unsigned char>(r,c) = low_threshold;
-            high_threshold_mask.at<unsigned char>(r,c) = high_threshold;
+                SubtractRow<1>(r, image, low_threshold_mask, high_threshold_mask);
         }
-    }
+    });
 
     m_frame_num++;
 }
 
 void Mean::Update(const cv::Mat& image,  const cv::Mat& update_mask)
 {
-    // update background model
-    for (unsigned int r = 0; r < m_params.Height(); ++r)
+    // perform conditional updating only if we are passed the learning phase
+    const bool learning = m_frame_num < m_params.LearningFrames();
+
+    // update background model, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // perform conditional updating only if we are passed the learning phase
-            if(update_mask.at<unsigned char>(r,c) == BACKGROUND || m_frame_num < m_params.LearningFrames())
-            {
-                // update B/G model
-                float mean;
-                if(m_params.Channels() == 3)
-                {
-                    for(int ch = 0; ch < 3; ++ch)
-                    {
-                        mean = m_params.Alpha() * m_mean.at<cv::Vec3b>(r,c)[ch] + (1.0f-m_params.Alpha()) * image.at<cv::Vec3b>(r,c)[ch];
-                        m_mean.at<cv::Vec3b>(r,c)[ch] = mean;
-                        m_background.at<cv::Vec3b>(r,c)[ch] = (unsigned char)(mean + 0.5);
-                    }
-                }
-                else
-                {
-                    mean = m_params.Alpha() * m_mean.at<unsigned char>(r,c) + (1.0f-m_params.Alpha()) * image.at<unsigned char>(r,c);
-                    m_mean.at<unsigned char>(r,c) = mean;
-                    m_background.at<unsigned char>(r,c) = (unsigned char)(mean + 0.5);
-                }
-            }
+            if(m_params.Channels() == 3)
+                UpdateRow<3>(r, image, update_mask, learning);
+            else
+                UpdateRow<1>(r, image, update_mask, learning);
         }
-    }
+    });
 }
 
-void Mean::SubtractPixel(int r, int c, const cv::Vec3b& pixel, unsigned char& low_threshold, unsigned char& high_threshold)
+template<int CHANNELS>
+void Mean::SubtractRow(int r, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
-    // calculate distance to sample point
-    float dist = 0;
-    for(int ch = 0; ch < 3; ++ch)
-    {
-        dist += (pixel[ch]-m_mean.at<cv::Vec3b>(r,c)[ch])*(pixel[ch]-m_mean.at<cv::Vec3b>(r,c)[ch]);
-    }
-
-    // determine if sample point is F/G or B/G pixel
-    low_threshold = BACKGROUND;
-    if(dist > m_params.LowThreshold())
-    {
-        low_threshold = FOREGROUND;
-    }
-
-    high_threshold = BACKGROUND;
-    if(dist > m_params.HighThreshold())
-    {
-        high_threshold = FOREGROUND;
-    }
+    typedef simd::VFloat V;
+    typedef simd::VFloat1 V1;
+
+    const V low = V::set1(m_params.LowThreshold()), high = V::set1(m_params.HighThreshold());
+    const V1 low1 = V1::set1(m_params.LowThreshold()), high1 = V1::set1(m_params.HighThreshold());
+
+    const float* mean[CHANNELS];
+    for(int ch = 0; ch < CHANNELS; ++ch)
+        mean[ch] = m_mean.ptr<float>(r*CHANNELS + ch);
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    unsigned char* lowMask = low_threshold_mask.ptr<unsigned char>(r);
+    unsigned char* highMask = high_threshold_mask.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        SubtractPixels<V, CHANNELS>(pixels + CHANNELS*c, mean, c, lowMask + c, highMask + c, low, high);
+    for(; c < width; ++c)
+        SubtractPixels<V1, CHANNELS>(pixels + CHANNELS*c, mean, c, lowMask + c, highMask + c, low1, high1);
 }
 
-void Mean::SubtractPixel(int r, int c, const unsigned char pixel, unsigned char& low_threshold, unsigned char& high_threshold)
+template<int CHANNELS>
+void Mean::UpdateRow(int r, const cv::Mat& image, const cv::Mat& update_mask, bool learning)
 {
-    // calculate distance to sample point
-    float dist = (pixel-m_mean.at<unsigned char>(r,c))*(pixel-m_mean.at<unsigned char>(r,c));
-
-    // determine if sample point is F/G or B/G pixel
-    low_threshold = BACKGROUND;
-    if(dist > m_params.LowThreshold())
-    {
-        low_threshold = FOREGROUND;
-    }
-
-    high_threshold = BACKGROUND;
-    if(dist > m_params.HighThreshold())
-    {
-        high_threshold = FOREGROUND;
-    }
+    typedef simd::VFloat V;
+    typedef simd::VFloat1 V1;
+
+    const V rate = V::set1(1.0f - m_params.Alpha());
+    const V1 rate1 = V1::set1(1.0f - m_params.Alpha());
+
+    float* mean[CHANNELS];
+    for(int ch = 0; ch < CHANNELS; ++ch)
+        mean[ch] = m_mean.ptr<float>(r*CHANNELS + ch);
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    const unsigned char* mask = update_mask.ptr<unsigned char>(r);
+    unsigned char* background = m_background.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        UpdatePixels<V, CHANNELS>(pixels + CHANNELS*c, mean, c, mask + c, background + CHANNELS*c, rate, learning);
+    for(; c < width; ++c)
+        UpdatePixels<V1, CHANNELS>(pixels + CHANNELS*c, mean, c, mask + c, background + CHANNELS*c, rate1, learning);
 }
-
-
@@ -29,6 +29,7 @@ public:
         m_high_threshold = 2*m_low_threshold;    // Note: high threshold is used by post-processing
     }
 
+    // weight of the previous mean in each update, the new frame gets 1 - Alpha()
     float &Alpha() { return m_alpha; }
     int &LearningFrames() { return m_learning_frames; }
 
@@ -64,11 +65,18 @@ public:
 
 private:
     void Initalize(const cv::Mat& image);
-    void SubtractPixel(int r, int c, const cv::Vec3b& pixel, unsigned char& lowThreshold, unsigned char& highThreshold);
-    void SubtractPixel(int r, int c, const unsigned char pixel, unsigned char& low_threshold, unsigned char& high_threshold);
+
+    template<int CHANNELS>
+    void SubtractRow(int r, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
+
+    template<int CHANNELS>
+    void UpdateRow(int r, const cv::Mat& image, const cv::Mat& update_mask, bool learning);
 
     MeanParams m_params;
+    // running mean in float, so small updates are not lost to rounding; one plane per
+    // channel with row r*Channels()+ch holding channel ch of image row r
     cv::Mat m_mean;
+    // m_mean rounded to the type of the image, refreshed by Update()
     cv::Mat m_background;
 };
 
@@ -0,0 +1,157 @@
+#include "ModelFile.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+using namespace bgs;
+
+/////////////////////////////////////////////////////////////////////////////
+// ModelChecksum
+
+void ModelChecksum::Add(const void* data, size_t bytes)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    const size_t words = bytes / 4;
+
+    // the sums cannot overflow within a run of this many words
+    const size_t RUN = 1 << 14;
+
+    for(size_t begin = 0; begin < words; begin += RUN)
+    {
+        const size_t end = std::min(begin + RUN, words);
+        uint64_t sum = m_sum;
+        uint64_t sum_of_sums = m_sum_of_sums;
+        for(size_t i = begin; i < end; ++i)
+        {
+            uint32_t word;
+            memcpy(&word, p + 4*i, 4);
+            sum += word;
+            sum_of_sums += sum;
+        }
+        m_sum = sum % 0xffffffffu;
+        m_sum_of_sums = sum_of_sums % 0xffffffffu;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ModelWriter
+
+bool ModelWriter::Open(const std::string& file, size_t header_bytes)
+{
+    if(m_file)
+    {
+        fclose(m_file);
+        remove(m_temporary.c_str());
+    }
+
+    // in the same directory, so the rename does not cross file systems
+    std::ostringstream temporary;
+    temporary << file << "." << getpid() << ".tmp";
+    m_target = file;
+    m_temporary = temporary.str();
+
+    m_file = fopen(m_temporary.c_str(), "wb");
+    m_offset = 0;
+    m_ok = m_file != 0;
+    m_checksum = ModelChecksum();
+    if(!m_ok)
+        return false;
+
+    // the header is written last, once the offsets and checksum are known
+    static const unsigned char zeros[ALIGNMENT] = {0};
+    size_t padded = (header_bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    for(size_t written = 0; written < padded; written += ALIGNMENT)
+        m_ok = m_ok && fwrite(zeros, 1, ALIGNMENT, m_file) == ALIGNMENT;
+    m_offset = padded;
+    return m_ok;
+}
+
+ModelWriter::~ModelWriter()
+{
+    // closed without Close(), so the target stays as it was
+    if(m_file)
+    {
+        fclose(m_file);
+        remove(m_temporary.c_str());
+    }
+}
+
+uint64_t ModelWriter::Write(const void* data, size_t bytes)
+{
+    static const unsigned char zeros[ALIGNMENT] = {0};
+
+    const uint64_t offset = m_offset;
+    size_t padding = (ALIGNMENT - bytes % ALIGNMENT) % ALIGNMENT;
+    m_offset += bytes + padding;
+
+    m_ok = m_ok && fwrite(data, 1, bytes, m_file) == bytes;
+    m_ok = m_ok && fwrite(zeros, 1, padding, m_file) == padding;
+
+    // the checksum covers whole words, which the padding completes
+    size_t whole = bytes & ~(size_t)3;
+    m_checksum.Add(data, whole);
+    if(whole < bytes)
+    {
+        unsigned char last[4] = {0};
+        memcpy(last, (const unsigned char*)data + whole, bytes - whole);
+        m_checksum.Add(last, 4);
+        padding -= 4 - (bytes - whole);
+    }
+    m_checksum.Add(zeros, padding);
+
+    return offset;
+}
+
+bool ModelWriter::Close(const void* header, size_t header_bytes)
+{
+    m_ok = m_ok && fseek(m_file, 0, SEEK_SET) == 0;
+    m_ok = m_ok && fwrite(header, 1, header_bytes, m_file) == header_bytes;
+    m_ok = (fclose(m_file) == 0) && m_ok;
+    m_file = 0;
+
+    // a mapping of the old file keeps its pages, the rename only replaces the name
+    m_ok = m_ok && rename(m_temporary.c_str(), m_target.c_str()) == 0;
+    if(!m_ok)
+        remove(m_temporary.c_str());
+    return m_ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// MappedFile
+
+MappedFile::~MappedFile()
+{
+    if(m_data)
+        munmap(m_data, m_size);
+}
+
+bool MappedFile::Open(const std::string& file)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    if(m_data)
+        munmap(m_data, m_size);
+    m_data = (unsigned char*)data;
+    m_size = info.st_size;
+    return true;
+}
@@ -0,0 +1,98 @@
+/****************************************************************************
+*
+* ModelFile.hpp
+*
+* Purpose: Building blocks for binary model files that are used in place
+*          rather than parsed. A model is written as a header followed by
+*          raw blocks of values, each starting on an ALIGNMENT boundary, and
+*          a checksum of everything after the header. Loading maps the file
+*          into memory and wraps cv::Mat headers around the blocks, so the
+*          values are only read from disk when they are first used.
+*
+******************************************************************************/
+
+#ifndef BGS_MODEL_FILE_H_
+#define BGS_MODEL_FILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+namespace bgs
+{
+
+// Fletcher-style checksum over 32-bit words. Data is added in multiples of 4 bytes.
+class ModelChecksum
+{
+public:
+    ModelChecksum() : m_sum(0), m_sum_of_sums(0) {}
+
+    void Add(const void* data, size_t bytes);
+
+    uint64_t Value() const { return (m_sum_of_sums << 32) ^ m_sum; }
+
+private:
+    uint64_t m_sum;
+    uint64_t m_sum_of_sums;
+};
+
+// Writes the blocks of a model file and keeps the checksum of what it wrote. The blocks go to
+// a temporary file next to the target, which Close() renames over it. The target is never left
+// half written, and it can be a file that is mapped and whose blocks are being written.
+class ModelWriter
+{
+public:
+    enum { ALIGNMENT = 64 };
+
+    ModelWriter() : m_file(0), m_offset(0), m_ok(false) {}
+    ~ModelWriter();
+
+    // Start writing 'file' and leave room for a header of header_bytes. Returns false if the
+    // temporary file cannot be created.
+    bool Open(const std::string& file, size_t header_bytes);
+
+    // Write a block padded to ALIGNMENT bytes and return its offset in the file.
+    uint64_t Write(const void* data, size_t bytes);
+
+    // Write the header at the start of the file, close it and move it over the target. Returns
+    // false if any write failed, in which case the target is unchanged.
+    bool Close(const void* header, size_t header_bytes);
+
+    uint64_t Checksum() const { return m_checksum.Value(); }
+    uint64_t Bytes() const { return m_offset; }
+
+private:
+    FILE* m_file;
+    std::string m_target;
+    std::string m_temporary;
+    uint64_t m_offset;
+    bool m_ok;
+    ModelChecksum m_checksum;
+};
+
+// A whole file mapped into memory. The pages are private and copy on write, so the values can
+// be changed in place without changing the file.
+class MappedFile
+{
+public:
+    MappedFile() : m_data(0), m_size(0) {}
+    ~MappedFile();
+
+    // Returns false if the file cannot be opened or mapped.
+    bool Open(const std::string& file);
+
+    unsigned char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    unsigned char* m_data;
+    size_t m_size;
+};
+
+}
+
+#endif
@@ -21,6 +21,7 @@
 #define Poppe_GMM_
 
 #include "Bgs.hpp"
+#include "GmmEngine.hpp"
 
 namespace bgs
 {
@@ -33,6 +34,8 @@ public:
         m_alpha = 0.001f;
         m_cgc = 1.8;
         m_max_modes = 3;
+        m_background_interval = 0;
+        m_half_float = false;
         m_low_threshold = 65;
         m_high_threshold = 2*m_low_threshold;    // Note: high threshold is used by post-processing
     }
@@ -41,6 +44,14 @@ public:
     int &MaxModes() { return m_max_modes; }
     float &cgc() { return m_cgc; }
 
+    // 0 builds the background image from the model when Background() is called. N > 0
+    // rebuilds it every N frames instead and Background() returns the latest one.
+    int &BackgroundInterval() { return m_background_interval; }
+
+    // Keep the model in 16 bits per value (see HalfStorage in GmmEngine.hpp): half the
+    // memory and memory traffic, the arithmetic is still done in float.
+    bool &HalfFloat() { return m_half_float; }
+
     void write(cv::FileStorage& fs) const {} // write serialization
     void read(const cv::FileNode& node){} // read serialization
 
@@ -50,32 +61,16 @@ private:
     float m_alpha;
     // Maximum number of modes (Gaussian components) that will be used per pixel
     int m_max_modes;
+    // Frames between updates of the background image, 0 updates it on demand
+    int m_background_interval;
+    // Store the model in 16 bits per value
+    bool m_half_float;
     // Consistent Gradual Change parameter - 1.8 gave best results in paper
     float m_cgc;
 };
 
 class PoppeGMM : public Bgs
 {
-private:
-    struct GMM
-    {
-    float variance;
-    float muR;
-    float muG;
-    float muB;
-    float weight;
-    float significants;        // this is equal to weight / standard deviation and is used to
-                            // determine which Gaussians should be part of the background model
-    };
-
-    struct compareGMM
-    {
-        inline bool operator() (const GMM& gmm1, const GMM& gmm2)
-        {
-            return (gmm1.significants > gmm2.significants);
-        }
-    };
-
 public:
     PoppeGMM();
     PoppeGMM(const BgsParams& p);
@@ -93,40 +88,23 @@ public:
     void Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
     void Update(const cv::Mat& image,  const cv::Mat& update_mask);
 
-    cv::Mat Background() { return m_background; }
+    cv::Mat Background();
 
 private:
     void Initalize(const cv::Mat& image);
-    void SubtractPixel(long posPixel, const cv::Vec3b& pixel, unsigned char& numModes, unsigned char& lowThreshold, unsigned char& highThreshold);
-    bool isPrevModel(const GMM& gmm1, const GMM& gmm2);
-    bool isPrevPixel(const cv::Vec3b& pixel1, const cv::Vec3b& pixel2, float std);
+    void UpdateBackground();
 
     // User adjustable parameters
     PoppeParams m_params;
 
-    // Threshold when the component becomes significant enough to be included into
-    // the background model. It is the TB = 1-cf from the paper. So I use cf=0.1 => TB=0.9
-    // For alpha=0.001 it means that the mode should exist for approximately 105 frames before
-    // it is considered foreground
-    float m_bg_threshold; //1-cf from the paper
-
-    // Initial variance for the newly generated components.
-    // It will will influence the speed of adaptation. A good guess should be made.
-    // A simple way is to estimate the typical standard deviation from the images.
-    float m_variance;
-
-    // Dynamic array for the mixture of Gaussians
-    std::vector<GMM> m_modes;
-
-    // past pixel and model
-    std::vector<cv::Vec3b> m_prevI;
-    std::vector<GMM> m_prevModel;
-
-    // Number of Gaussian components per pixel
-    cv::Mat m_modes_per_pixel;
+    // Mixture of Gaussians for every pixel, ordered by weight / standard deviation
+    // and matched with the consistent gradual change test
+    GmmEngine<SignificanceOrder, NoPrune, ConsistentGradualChange, 3> m_gmm;
 
     // Current background model
     cv::Mat m_background;
+    // Set when the model changed since m_background was last built
+    bool m_background_dirty;
 };
 
 }
@@ -1,4 +1,5 @@
 #include "PratiMediod.hpp"
+#include "Simd.hpp"
 
 using namespace bgs;
 
@@ -6,12 +7,14 @@ PratiMediod::PratiMediod()
 {
     m_params = PratiParams();
     m_frame_num = 0;
+    m_hysteresis.ClearBorder() = true;
 }
 
 PratiMediod::PratiMediod(const BgsParams &p)
 {
     m_params = (PratiParams&)p;
     m_frame_num = 0;
+    m_hysteresis.ClearBorder() = true;
 }
 
 PratiMediod::~PratiMediod()
@@ -24,6 +27,10 @@ void PratiMediod::Initalize(const cv::Mat& image)
     if(image.type() != CV_8UC3)
         CV_Error( CV_StsUnsupportedFormat, "Only 3-channel 8-bit images are supported in libBGS" );
 
+    // the distance sums are kept in 16 bits: (HistorySize()-1)*255 must fit
+    if(m_params.HistorySize() < 1 || m_params.HistorySize() > 257)
+        CV_Error( CV_StsOutOfRange, "HistorySize() must be between 1 and 257 in PratiMediod" );
+
     m_params.SetFrameSize(image.cols, image.rows);
     m_params.Channels() = image.channels();
 
@@ -32,7 +39,11 @@ void PratiMediod::Initalize(const cv::Mat& image)
 
     m_background = cv::Mat(m_params.Height(), m_params.Width(), image.type());
 
-    m_median_buffer.resize(m_params.Size());
+    m_samples = cv::Mat::zeros(3*m_params.HistorySize(), m_params.Size(), CV_8U);
+    m_dist = cv::Mat::zeros(m_params.HistorySize(), m_params.Size(), CV_16U);
+    m_pos = cv::Mat::zeros(1, m_params.Size(), CV_16U);
+    m_median = cv::Mat::zeros(3, m_params.Size(), CV_8U);
+    m_samples_taken = 0;
 }
 
 void PratiMediod::Save(std::string file)
@@ -45,6 +56,22 @@ void PratiMediod::Load(std::string file)
 
 }
 
+namespace
+{
+
+// Threshold as a 16-bit value t such that dist > t for an integer dist exactly when dist
+// is above the threshold.
+unsigned short ThresholdU16(float threshold)
+{
+    if(threshold <= 0)
+        return 0;
+    if(threshold >= 65535)
+        return 0xffff;
+    return (unsigned short)threshold;
+}
+
+}
+
 void PratiMediod::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
     if(m_frame_num == 0)
@@ -60,22 +87,41 @@ void PratiMediod::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv
     {
         low_threshold_mask = cv::Mat::zeros(low_threshold_mask.size(), low_threshold_mask.type());
         high_threshold_mask = cv::Mat::zeros(high_threshold_mask.size(), high_threshold_mask.type());
+        m_frame_num++;
         return;
     }
 
-    // update each pixel of the image
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    const simd::VU16 low = simd::VU16::set1(ThresholdU16(m_params.LowThreshold()));
+    const simd::VU16 high = simd::VU16::set1(ThresholdU16(m_params.HighThreshold()));
+    const simd::VU16x1 low1 = simd::VU16x1::set1(ThresholdU16(m_params.LowThreshold()));
+    const simd::VU16x1 high1 = simd::VU16x1::set1(ThresholdU16(m_params.HighThreshold()));
+
+    // compare each pixel of the image with its mediod, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        const int width = m_params.Width();
+        const int step = simd::VU16::WIDTH;
+
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // need at least one frame of image before we can start calculating the masks
-            CalculateMasks(r, c, image.at<cv::Vec3b>(r,c));
+            const unsigned char* pixels = image.ptr<unsigned char>(r);
+            unsigned char* background = m_background.ptr<unsigned char>(r);
+            unsigned char* lowMask = m_mask_low_threshold.ptr<unsigned char>(r);
+            unsigned char* highMask = m_mask_high_threshold.ptr<unsigned char>(r);
+            long posPixel = (long)r*width;
+
+            int c = 0;
+            for(; c + step <= width; c += step)
+                CalculateMasks(posPixel+c, pixels+3*c, background+3*c, lowMask+c, highMask+c, low, high);
+            for(; c < width; ++c)
+                CalculateMasks(posPixel+c, pixels+3*c, background+3*c, lowMask+c, highMask+c, low1, high1);
         }
-    }
+    });
 
     // combine low and high threshold masks
-    Combine(m_mask_low_threshold, m_mask_high_threshold, low_threshold_mask);
-    Combine(m_mask_low_threshold, m_mask_high_threshold, high_threshold_mask);
+    m_hysteresis.Threads() = m_params.Threads();
+    m_hysteresis.Apply(m_mask_low_threshold, m_mask_high_threshold, low_threshold_mask);
+    low_threshold_mask.copyTo(high_threshold_mask);
 
     m_frame_num++;
 }
@@ -83,172 +129,182 @@ void PratiMediod::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv
 void PratiMediod::Update(const cv::Mat& image,  const cv::Mat& update_mask)
 {
     // update the image buffer with the new frame and calculate new median values
-    if(m_frame_num % m_params.SamplingRate() == 0)
+    if(m_frame_num % m_params.SamplingRate() != 0)
+        return;
+
+    // once the history is full only background pixels take a new sample
+    const bool full = m_samples_taken == m_params.HistorySize();
+
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        if((int)m_median_buffer[0].dist.size() == (int)m_params.HistorySize())
+        const int width = m_params.Width();
+        const int step = simd::VU16::WIDTH;
+
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // subtract distance to sample being removed from all distances
-            for(unsigned int r = 0; r < m_params.Height(); ++r)
+            const unsigned char* pixels = image.ptr<unsigned char>(r);
+            const unsigned char* mask = update_mask.ptr<unsigned char>(r);
+            long posPixel = (long)r*width;
+
+            int c = 0;
+            if(full)
             {
-                for(unsigned int c = 0; c < m_params.Width(); ++c)
-                {
-                    int i = r*m_params.Width()+c;
-
-                    if(update_mask.at<unsigned char>(r,c) == BACKGROUND)
-                    {
-                        int oldPos = m_median_buffer[i].pos;
-                        for(unsigned int s = 0; s < m_median_buffer[i].pixels.size(); ++s)
-                        {
-                            int maxDist = 0;
-                            for(int ch = 0; ch < 3; ++ch)
-                            {
-                                int tempDist = abs(m_median_buffer[i].pixels.at(oldPos)[ch] - m_median_buffer[i].pixels.at(s)[ch]);
-                                if(tempDist > maxDist)
-                                    maxDist = tempDist;
-                            }
-
-                            m_median_buffer[i].dist.at(s) -= maxDist;
-                        }
-
-                        int dist;
-                        UpdateMediod(r, c, image, dist);
-                        m_median_buffer[i].dist.at(oldPos) = dist;
-                        m_median_buffer[i].pixels.at(oldPos) = image.at<unsigned char>(r,c);
-                        m_median_buffer[i].pos++;
-                        if(m_median_buffer[i].pos >= m_params.HistorySize())
-                            m_median_buffer[i].pos = 0;
-                    }
-                }
+                for(; c + step <= width; c += step)
+                    UpdateMediod<simd::VU16, true>(posPixel+c, pixels+3*c, mask+c);
+                for(; c < width; ++c)
+                    UpdateMediod<simd::VU16x1, true>(posPixel+c, pixels+3*c, mask+c);
             }
-        }
-        else
-        {
-            // calculate sum of L-inf distances for new point and
-            // add distance from each sample point to this point to their L-inf sum
-            int dist;
-            for(unsigned int r = 0; r < m_params.Height(); ++r)
+            else
             {
-                for(unsigned int c = 0; c < m_params.Width(); ++c)
-                {
-                    int index = r*m_params.Width()+c;
-                    UpdateMediod(r, c, image, dist);
-                    m_median_buffer[index].dist.push_back(dist);
-                    m_median_buffer[index].pos = 0;
-                    m_median_buffer[index].pixels.push_back(image.at<unsigned char>(r,c));
-                }
+                for(; c + step <= width; c += step)
+                    UpdateMediod<simd::VU16, false>(posPixel+c, pixels+3*c, mask+c);
+                for(; c < width; ++c)
+                    UpdateMediod<simd::VU16x1, false>(posPixel+c, pixels+3*c, mask+c);
             }
         }
-    }
+    });
+
+    if(!full)
+        m_samples_taken++;
 }
 
-void PratiMediod::UpdateMediod(int r, int c, const cv::Mat& new_frame, int& dist)
+// Add the pixels i .. i+WIDTH-1 of a new frame to their history and find the new mediods.
+// The L-inf distance from each sample to the new pixel is added to the distance sum of that
+// sample; once the history is full the distance to the sample being replaced is taken off
+// again and the new pixel goes into its slot. The mediod is the sample with the smallest
+// sum, the earliest slot on a tie and the new pixel only if it is strictly closer.
+template<class V, bool FULL>
+void PratiMediod::UpdateMediod(long i, const unsigned char* pixels, const unsigned char* update_mask)
 {
-    // calculate sum of L-inf distances for new point and
-    // add distance from each sample point to this point to their L-inf sum
-    unsigned int i = (r*m_params.Width()+c);
+    typedef typename V::Mask M;
 
-    m_median_buffer[i].medianDist = INT_MAX;
+    const int count = FULL ? m_params.HistorySize() : m_samples_taken;
 
-    int L_inf_dist = 0;
-    for(unsigned int s = 0; s < m_median_buffer[i].dist.size(); ++s)
+    M update = ~M::none();
+    if(FULL)
     {
-        int maxDist = 0;
-        for(int ch = 0; ch < 3; ++ch)
-        {
-            int tempDist = abs(m_median_buffer[i].pixels.at(s)[ch] - new_frame.at<cv::Vec3b>(r,c)[ch]);
-            if(tempDist > maxDist)
-                maxDist = tempDist;
-        }
+        update = V::load_u8(update_mask) == V::set1(BACKGROUND);
+        if(!update.any())
+            return;
+    }
+
+    V pixel[3];
+    for(int ch = 0; ch < 3; ++ch)
+        pixel[ch] = V::load_u8(pixels+ch, 3);
 
-        // check if point from this frame in the image buffer is the median
-        m_median_buffer[i].dist.at(s) += maxDist;
-        if(m_median_buffer[i].dist.at(s) < m_median_buffer[i].medianDist)
+    // slot the new pixel goes into and, once the history is full, the sample it replaces
+    unsigned short slot[V::WIDTH];
+    V pos = V::set1((unsigned short)count);
+    V old[3];
+    if(FULL)
+    {
+        pos = V::load(m_pos.ptr<unsigned short>() + i);
+        V::store(slot, pos);
+        for(int ch = 0; ch < 3; ++ch)
         {
-            m_median_buffer[i].medianDist = m_median_buffer[i].dist.at(s);
-            m_median_buffer[i].median = m_median_buffer[i].pixels.at(s);
+            unsigned char values[V::WIDTH];
+            for(int l = 0; l < V::WIDTH; ++l)
+                values[l] = m_samples.ptr<unsigned char>(3*slot[l] + ch)[i+l];
+            old[ch] = V::load_u8(values);
         }
-
-        L_inf_dist += maxDist;
     }
 
-    dist = L_inf_dist;
+    V newDist = V::zero();
+    V medianDist = V::set1(0xffff);
+    V median[3] = { V::zero(), V::zero(), V::zero() };
 
-    // check if the new point is the median
-    if(L_inf_dist < m_median_buffer[i].medianDist)
+    for(int s = 0; s < count; ++s)
     {
-        m_median_buffer[i].medianDist = L_inf_dist;
-        m_median_buffer[i].median = new_frame.at<cv::Vec3b>(r,c);
-    }
-}
+        unsigned short* dist = m_dist.ptr<unsigned short>(s) + i;
 
-void PratiMediod::Combine(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output)
-{
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
-    {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        V sample[3];
+        V dNew = V::zero();
+        for(int ch = 0; ch < 3; ++ch)
         {
-            output.at<unsigned char>(r,c) = BACKGROUND;
-
-            if(r == 0 || c == 0 || r == m_params.Height()-1 || c == m_params.Width()-1)
-                continue;
+            sample[ch] = V::load_u8(m_samples.ptr<unsigned char>(3*s + ch) + i);
+            dNew = v_max(dNew, v_absdiff(sample[ch], pixel[ch]));
+        }
 
-            if(high_mask.at<unsigned char>(r,c) == FOREGROUND)
-            {
-                output.at<unsigned char>(r,c) = FOREGROUND;
-            }
-            else if(low_mask.at<unsigned char>(r,c) == FOREGROUND)
-            {
-                // consider the pixel to be a F/G pixel if it is 8-connected to
-                // a F/G pixel in the high mask
-                // check if there is an 8-connected foreground pixel
-                if(high_mask.at<unsigned char>(r-1,c-1))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r-1,c))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r-1,c+1))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r,c-1))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r,c+1))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r+1,c-1))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r+1,c))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-                else if(high_mask.at<unsigned char>(r+1,c+1))
-                    output.at<unsigned char>(r,c) = FOREGROUND;
-            }
+        V d = V::load(dist);
+        M candidate = update;
+        if(FULL)
+        {
+            V dOld = V::zero();
+            for(int ch = 0; ch < 3; ++ch)
+                dOld = v_max(dOld, v_absdiff(sample[ch], old[ch]));
+
+            // the sample being replaced takes no part
+            M replaced = pos == V::set1((unsigned short)s);
+            candidate = update & ~replaced;
+            newDist = newDist + v_select(replaced, V::zero(), dNew);
+            d = v_select(candidate, d + dNew - dOld, d);
         }
-    }
-}
+        else
+        {
+            newDist = newDist + dNew;
+            d = d + dNew;
+        }
+        V::store(dist, d);
 
-void PratiMediod::CalculateMasks(int r, int c, const cv::Vec3b& pixel)
-{
-    int pos = r*m_params.Width()+c;
+        M better = candidate & (d < medianDist);
+        medianDist = v_select(better, d, medianDist);
+        for(int ch = 0; ch < 3; ++ch)
+            median[ch] = v_select(better, sample[ch], median[ch]);
+    }
 
-    // calculate l-inf distance between current value and median value
-    unsigned char dist = 0;
+    // check if the new point is the median
+    M better = newDist < medianDist;
     for(int ch = 0; ch < 3; ++ch)
     {
-        int tempDist = abs(pixel[ch] - m_median_buffer[pos].median(ch));
-        if(tempDist > dist)
-            dist = tempDist;
+        median[ch] = v_select(better, pixel[ch], median[ch]);
+        unsigned char* out = m_median.ptr<unsigned char>(ch) + i;
+        V::store_u8(out, v_select(update, median[ch], V::load_u8(out)));
     }
-    m_background.at<cv::Vec3b>(r,c) = m_median_buffer[pos].median;
 
-    // check if pixel is a B/G or F/G pixel according to the low threshold B/G model
-    m_mask_low_threshold.at<unsigned char>(r,c) = BACKGROUND;
-    if(dist > m_params.LowThreshold())
+    if(!FULL)
     {
-        m_mask_low_threshold.at<unsigned char>(r,c) = FOREGROUND;
+        V::store(m_dist.ptr<unsigned short>(count) + i, newDist);
+        for(int ch = 0; ch < 3; ++ch)
+            V::store_u8(m_samples.ptr<unsigned char>(3*count + ch) + i, pixel[ch]);
+        return;
     }
 
-    // check if pixel is a B/G or F/G pixel according to the high threshold B/G model
-    m_mask_high_threshold.at<unsigned char>(r,c)= BACKGROUND;
-    if(dist > m_params.HighThreshold())
+    // the new pixel replaces the oldest sample of each updated lane
+    unsigned short dists[V::WIDTH];
+    unsigned char values[3][V::WIDTH];
+    V::store(dists, newDist);
+    for(int ch = 0; ch < 3; ++ch)
+        V::store_u8(values[ch], pixel[ch]);
+
+    unsigned short* next = m_pos.ptr<unsigned short>() + i;
+    for(int l = 0; l < V::WIDTH; ++l)
     {
-        m_mask_high_threshold.at<unsigned char>(r,c) = FOREGROUND;
+        if(!update.lane(l))
+            continue;
+
+        const int s = slot[l];
+        for(int ch = 0; ch < 3; ++ch)
+            m_samples.ptr<unsigned char>(3*s + ch)[i+l] = values[ch][l];
+        m_dist.ptr<unsigned short>(s)[i+l] = dists[l];
+        next[l] = (unsigned short)(s+1 == count ? 0 : s+1);
     }
 }
 
+// L-inf distance between the pixels i .. i+WIDTH-1 and their mediods, compared against
+// both thresholds
+template<class V>
+void PratiMediod::CalculateMasks(long i, const unsigned char* pixels, unsigned char* background,
+                                 unsigned char* low, unsigned char* high, const V& low_threshold, const V& high_threshold)
+{
+    V dist = V::zero();
+    for(int ch = 0; ch < 3; ++ch)
+    {
+        V median = V::load_u8(m_median.ptr<unsigned char>(ch) + i);
+        dist = v_max(dist, v_absdiff(V::load_u8(pixels+ch, 3), median));
+        V::store_u8(background+ch, median, 3);
+    }
 
+    // check if pixel is a B/G or F/G pixel according to the low and high threshold B/G models
+    v_store_mask_u8(low, dist > low_threshold, FOREGROUND, BACKGROUND);
+    v_store_mask_u8(high, dist > high_threshold, FOREGROUND, BACKGROUND);
+}
@@ -24,6 +24,7 @@
 #define PRATI_MEDIA_BGS_H
 
 #include "Bgs.hpp"
+#include "Hysteresis.hpp"
 
 namespace bgs
 {
@@ -60,18 +61,6 @@ private:
 
 class PratiMediod : public Bgs
 {
-private:
-    // sum of L-inf distances from a sample point to all other sample points
-    struct MEDIAN_BUFFER
-    {
-        std::vector<cv::Vec3b> pixels;            // vector of pixels at give location in image
-        std::vector<int> dist;                    // distance from pixel to all other pixels
-        int pos;                                                // current position in circular buffer
-
-        cv::Vec3b median;                                // median at this pixel location
-        int medianDist;                                    // distance from median pixel to all other pixels
-    };
-
 public:
     PratiMediod();
     PratiMediod(const BgsParams& p);
@@ -93,15 +82,35 @@ public:
 
 private:
     void Initalize(const cv::Mat& image);
-    void CalculateMasks(int r, int c, const cv::Vec3b& pixel);
-    void Combine(const cv::Mat& low_mask, const cv::Mat& high_mask, cv::Mat& output);
-    void UpdateMediod(int r, int c, const cv::Mat& new_frame, int& dist);
+
+    template<class V>
+    void CalculateMasks(long i, const unsigned char* pixels, unsigned char* background,
+                        unsigned char* low, unsigned char* high, const V& low_threshold, const V& high_threshold);
+
+    template<class V, bool FULL>
+    void UpdateMediod(long i, const unsigned char* pixels, const unsigned char* update_mask);
 
     PratiParams m_params;
-    std::vector<MEDIAN_BUFFER> m_median_buffer;
+
+    // Samples of every pixel, one plane per history slot and channel: row s*3+ch holds
+    // channel ch of slot s for all pixels, so a slot is read a row of pixels at a time.
+    cv::Mat m_samples;
+    // row s holds, for every pixel, the sum of L-inf distances from the sample in slot s
+    // to the other samples of that pixel (CV_16U)
+    cv::Mat m_dist;
+    // slot each pixel replaces next once the history is full (CV_16U)
+    cv::Mat m_pos;
+    // number of slots in use while the history is filling up
+    int m_samples_taken;
+    // mediod of every pixel, one row per channel
+    cv::Mat m_median;
+
     cv::Mat m_mask_low_threshold;
     cv::Mat m_mask_high_threshold;
     cv::Mat m_background;
+
+    // the 8-neighbour rule of [1], leaving the edge of the frame as background
+    Hysteresis m_hysteresis;
 };
 
 }
@@ -0,0 +1,14 @@
+#include "Simd.hpp"
+
+const char* bgs::simd::Level()
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__AVX__)
+    return "avx";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "none";
+#endif
+}
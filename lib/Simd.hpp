@@ -0,0 +1,802 @@
+/****************************************************************************
+*
+* Simd.hpp
+*
+* Purpose: Thin wrappers around the SSE2/AVX float intrinsics so a per-pixel
+*          kernel can be written once and instantiated for 1, 4 or 8 pixels
+*          at a time. VFloat is the widest type the compiler was told it may
+*          use (build with -mavx to get 8 lanes), VFloat1 is the scalar type
+*          used for the pixels left over at the end of a row.
+*
+*          The float vectors also load and store two 16-bit formats: IEEE
+*          half precision (Float16), converted with the F16C instructions
+*          when the compiler may use them (-mf16c) and a bit-exact software
+*          conversion otherwise, and unsigned Q8.8 fixed point (Q8_8) for
+*          values in [0,256) that need a uniform resolution.
+*
+*          VU16 is the matching set of unsigned 16-bit integer vectors used
+*          by the fixed-point kernels (8 lanes with SSE2). All operations
+*          are defined lane by lane, so VU16x1 gives bit-identical results.
+*          VU8 does the same for bytes, which is what the masks and 8-bit
+*          models are made of (32 lanes when built with -mavx2).
+*
+******************************************************************************/
+
+#ifndef BGS_SIMD_H_
+#define BGS_SIMD_H_
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace bgs
+{
+namespace simd
+{
+
+/////////////////////////////////////////////////////////////////////////////
+// half precision storage
+
+// IEEE 754 binary16 value, only used to store floats
+struct Float16
+{
+    unsigned short bits;
+};
+
+// float to half, rounding to nearest even like the F16C instructions
+inline Float16 to_float16(float f)
+{
+    Float16 h;
+#if defined(__F16C__)
+    h.bits = (unsigned short)_cvtss_sh(f, 0);
+#else
+    unsigned int x;
+    memcpy(&x, &f, sizeof(x));
+
+    unsigned int sign = (x >> 16) & 0x8000;
+    int e = (int)((x >> 23) & 0xff);
+    unsigned int mant = x & 0x7fffff;
+
+    if(e == 0xff)
+    {
+        // infinity and NaN
+        h.bits = (unsigned short)(sign | 0x7c00 | (mant ? 0x200 : 0));
+        return h;
+    }
+
+    int he = e - 127 + 15;
+    if(he >= 31)
+    {
+        h.bits = (unsigned short)(sign | 0x7c00);
+        return h;
+    }
+
+    unsigned int shift;
+    unsigned int bits;
+    if(he > 0)
+    {
+        bits = ((unsigned int)he << 10) | (mant >> 13);
+        shift = 13;
+    }
+    else
+    {
+        // subnormal half, the implicit bit becomes part of the mantissa
+        shift = (unsigned int)(14 - he);
+        if(shift > 24)
+        {
+            h.bits = (unsigned short)sign;
+            return h;
+        }
+        mant |= 0x800000;
+        bits = mant >> shift;
+    }
+
+    // round to nearest even, a carry out of the mantissa correctly bumps the exponent
+    unsigned int rest = mant & ((1u << shift) - 1);
+    unsigned int halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (bits & 1)))
+        bits++;
+
+    h.bits = (unsigned short)(sign | bits);
+#endif
+    return h;
+}
+
+inline float from_float16(Float16 h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(h.bits);
+#else
+    unsigned int sign = (unsigned int)(h.bits & 0x8000) << 16;
+    unsigned int e = (h.bits >> 10) & 0x1f;
+    unsigned int mant = h.bits & 0x3ff;
+    unsigned int x;
+
+    if(e == 0x1f)
+    {
+        x = sign | 0x7f800000 | (mant << 13);
+    }
+    else if(e != 0)
+    {
+        x = sign | ((e + 127 - 15) << 23) | (mant << 13);
+    }
+    else if(mant == 0)
+    {
+        x = sign;
+    }
+    else
+    {
+        // subnormal half, normalise
+        e = 127 - 15 + 1;
+        while(!(mant & 0x400))
+        {
+            mant <<= 1;
+            e--;
+        }
+        x = sign | (e << 23) | ((mant & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+#endif
+}
+
+// unsigned 8.8 fixed point value, x*256
+struct Q8_8
+{
+    unsigned short bits;
+};
+
+// rounds to nearest and clamps to [0,256), the vector versions do exactly the same
+inline Q8_8 to_q8_8(float f)
+{
+    float x = f*256.0f + 0.5f;
+    x = x > 0.0f ? x : 0.0f;
+    x = x < 65535.0f ? x : 65535.0f;
+    Q8_8 q;
+    q.bits = (unsigned short)x;
+    return q;
+}
+
+inline float from_q8_8(Q8_8 q) { return (float)q.bits * (1.0f/256.0f); }
+
+/////////////////////////////////////////////////////////////////////////////
+// scalar (1 lane)
+
+struct MaskF1
+{
+    bool m;
+
+    MaskF1() {}
+    explicit MaskF1(bool b) : m(b) {}
+
+    static MaskF1 none() { return MaskF1(false); }
+    bool any() const { return m; }
+    bool lane(int) const { return m; }
+};
+
+inline MaskF1 operator&(MaskF1 a, MaskF1 b) { return MaskF1(a.m && b.m); }
+inline MaskF1 operator|(MaskF1 a, MaskF1 b) { return MaskF1(a.m || b.m); }
+inline MaskF1 operator~(MaskF1 a) { return MaskF1(!a.m); }
+
+struct VFloat1
+{
+    typedef MaskF1 Mask;
+    enum { WIDTH = 1 };
+
+    float v;
+
+    VFloat1() {}
+    explicit VFloat1(float f) : v(f) {}
+
+    static VFloat1 zero() { return VFloat1(0.0f); }
+    static VFloat1 set1(float f) { return VFloat1(f); }
+    static VFloat1 load(const float* p) { return VFloat1(*p); }
+    static void store(float* p, VFloat1 a) { *p = a.v; }
+    static VFloat1 load(const Float16* p) { return VFloat1(from_float16(*p)); }
+    static void store(Float16* p, VFloat1 a) { *p = to_float16(a.v); }
+    static VFloat1 load(const Q8_8* p) { return VFloat1(from_q8_8(*p)); }
+    static void store(Q8_8* p, VFloat1 a) { *p = to_q8_8(a.v); }
+
+    // load WIDTH bytes, 'stride' bytes apart, and convert them to float
+    static VFloat1 load_u8(const unsigned char* p, int = 1) { return VFloat1((float)p[0]); }
+    // convert to bytes (values must already be in [0,255])
+    static void store_u8(unsigned char* p, VFloat1 a, int = 1) { p[0] = (unsigned char)a.v; }
+};
+
+inline VFloat1 operator+(VFloat1 a, VFloat1 b) { return VFloat1(a.v + b.v); }
+inline VFloat1 operator-(VFloat1 a, VFloat1 b) { return VFloat1(a.v - b.v); }
+inline VFloat1 operator*(VFloat1 a, VFloat1 b) { return VFloat1(a.v * b.v); }
+inline VFloat1 operator/(VFloat1 a, VFloat1 b) { return VFloat1(a.v / b.v); }
+inline MaskF1 operator<(VFloat1 a, VFloat1 b) { return MaskF1(a.v < b.v); }
+inline MaskF1 operator>(VFloat1 a, VFloat1 b) { return MaskF1(a.v > b.v); }
+inline MaskF1 operator==(VFloat1 a, VFloat1 b) { return MaskF1(a.v == b.v); }
+inline VFloat1 v_sqrt(VFloat1 a) { return VFloat1(sqrtf(a.v)); }
+inline VFloat1 v_min(VFloat1 a, VFloat1 b) { return VFloat1(b.v < a.v ? b.v : a.v); }
+inline VFloat1 v_max(VFloat1 a, VFloat1 b) { return VFloat1(b.v > a.v ? b.v : a.v); }
+inline VFloat1 v_select(MaskF1 m, VFloat1 a, VFloat1 b) { return m.m ? a : b; }
+
+// write one byte per lane: 'a' where the mask is set, 'b' elsewhere
+inline void v_store_mask_u8(unsigned char* p, MaskF1 m, unsigned char a, unsigned char b) { p[0] = m.m ? a : b; }
+
+/////////////////////////////////////////////////////////////////////////////
+// scalar unsigned 16-bit (1 lane)
+
+struct VU16x1
+{
+    typedef MaskF1 Mask;
+    enum { WIDTH = 1 };
+
+    unsigned short v;
+
+    VU16x1() {}
+    explicit VU16x1(unsigned short x) : v(x) {}
+
+    static VU16x1 zero() { return VU16x1(0); }
+    static VU16x1 set1(unsigned short x) { return VU16x1(x); }
+    static VU16x1 load(const unsigned short* p) { return VU16x1(*p); }
+    static void store(unsigned short* p, VU16x1 a) { *p = a.v; }
+
+    static VU16x1 load_u8(const unsigned char* p, int = 1) { return VU16x1(p[0]); }
+    // values must already be in [0,255]
+    static void store_u8(unsigned char* p, VU16x1 a, int = 1) { p[0] = (unsigned char)a.v; }
+};
+
+// wrapping arithmetic
+inline VU16x1 operator+(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)(a.v + b.v)); }
+inline VU16x1 operator-(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)(a.v - b.v)); }
+inline VU16x1 v_shl(VU16x1 a, int n) { return VU16x1((unsigned short)(a.v << n)); }
+inline VU16x1 v_shr(VU16x1 a, int n) { return VU16x1((unsigned short)(a.v >> n)); }
+// saturating arithmetic
+inline VU16x1 v_adds(VU16x1 a, VU16x1 b) { unsigned int s = a.v + b.v; return VU16x1((unsigned short)(s > 0xffff ? 0xffff : s)); }
+inline VU16x1 v_subs(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)(a.v > b.v ? a.v - b.v : 0)); }
+// high and low half of the 32-bit product
+inline VU16x1 v_mulhi(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)(((unsigned int)a.v*b.v) >> 16)); }
+inline VU16x1 v_mullo(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)((unsigned int)a.v*b.v)); }
+// (a*b + 0x8000) >> 16
+inline VU16x1 v_mulhi_round(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)(((unsigned int)a.v*b.v + 0x8000) >> 16)); }
+inline MaskF1 operator<(VU16x1 a, VU16x1 b) { return MaskF1(a.v < b.v); }
+inline MaskF1 operator>(VU16x1 a, VU16x1 b) { return MaskF1(a.v > b.v); }
+inline MaskF1 operator==(VU16x1 a, VU16x1 b) { return MaskF1(a.v == b.v); }
+inline VU16x1 v_min(VU16x1 a, VU16x1 b) { return VU16x1(b.v < a.v ? b.v : a.v); }
+inline VU16x1 v_max(VU16x1 a, VU16x1 b) { return VU16x1(b.v > a.v ? b.v : a.v); }
+inline VU16x1 v_absdiff(VU16x1 a, VU16x1 b) { return VU16x1((unsigned short)(a.v > b.v ? a.v - b.v : b.v - a.v)); }
+inline VU16x1 v_select(MaskF1 m, VU16x1 a, VU16x1 b) { return m.m ? a : b; }
+
+/////////////////////////////////////////////////////////////////////////////
+// scalar unsigned 8-bit (1 lane)
+
+// Comparisons return a VU8 with 0xff in the lanes where they hold, so they combine with
+// the bitwise operators and store as 0/255 masks.
+struct VU8x1
+{
+    enum { WIDTH = 1 };
+
+    unsigned char v;
+
+    VU8x1() {}
+    explicit VU8x1(unsigned char x) : v(x) {}
+
+    static VU8x1 zero() { return VU8x1(0); }
+    static VU8x1 set1(unsigned char x) { return VU8x1(x); }
+    static VU8x1 load(const unsigned char* p) { return VU8x1(*p); }
+    static void store(unsigned char* p, VU8x1 a) { *p = a.v; }
+};
+
+inline VU8x1 operator|(VU8x1 a, VU8x1 b) { return VU8x1((unsigned char)(a.v | b.v)); }
+inline VU8x1 operator&(VU8x1 a, VU8x1 b) { return VU8x1((unsigned char)(a.v & b.v)); }
+inline VU8x1 operator~(VU8x1 a) { return VU8x1((unsigned char)~a.v); }
+// wrapping arithmetic
+inline VU8x1 operator+(VU8x1 a, VU8x1 b) { return VU8x1((unsigned char)(a.v + b.v)); }
+inline VU8x1 operator-(VU8x1 a, VU8x1 b) { return VU8x1((unsigned char)(a.v - b.v)); }
+inline VU8x1 operator==(VU8x1 a, VU8x1 b) { return VU8x1(a.v == b.v ? 0xff : 0); }
+inline VU8x1 operator>(VU8x1 a, VU8x1 b) { return VU8x1(a.v > b.v ? 0xff : 0); }
+inline VU8x1 v_min(VU8x1 a, VU8x1 b) { return VU8x1(b.v < a.v ? b.v : a.v); }
+inline VU8x1 v_max(VU8x1 a, VU8x1 b) { return VU8x1(b.v > a.v ? b.v : a.v); }
+inline VU8x1 v_absdiff(VU8x1 a, VU8x1 b) { return VU8x1((unsigned char)(a.v > b.v ? a.v - b.v : b.v - a.v)); }
+inline VU8x1 v_select(VU8x1 m, VU8x1 a, VU8x1 b) { return (a & m) | (b & ~m); }
+inline bool v_any(VU8x1 a) { return a.v != 0; }
+
+// Split 3*WIDTH bytes of interleaved 3-channel pixels into a vector per channel, and back.
+// With one lane the three bytes already are the channels.
+inline void v_deinterleave3(VU8x1 a0, VU8x1 a1, VU8x1 a2, VU8x1& x, VU8x1& y, VU8x1& z) { x = a0; y = a1; z = a2; }
+inline void v_interleave3(VU8x1 x, VU8x1 y, VU8x1 z, VU8x1& a0, VU8x1& a1, VU8x1& a2) { a0 = x; a1 = y; a2 = z; }
+
+#if defined(__SSE2__)
+
+/////////////////////////////////////////////////////////////////////////////
+// SSE2 (4 lanes)
+
+struct MaskF4
+{
+    __m128 m;
+
+    MaskF4() {}
+    explicit MaskF4(__m128 x) : m(x) {}
+
+    static MaskF4 none() { return MaskF4(_mm_setzero_ps()); }
+    bool any() const { return _mm_movemask_ps(m) != 0; }
+    bool lane(int i) const { return (_mm_movemask_ps(m) >> i) & 1; }
+};
+
+inline MaskF4 operator&(MaskF4 a, MaskF4 b) { return MaskF4(_mm_and_ps(a.m, b.m)); }
+inline MaskF4 operator|(MaskF4 a, MaskF4 b) { return MaskF4(_mm_or_ps(a.m, b.m)); }
+inline MaskF4 operator~(MaskF4 a) { return MaskF4(_mm_xor_ps(a.m, _mm_castsi128_ps(_mm_set1_epi32(-1)))); }
+
+struct VFloat4
+{
+    typedef MaskF4 Mask;
+    enum { WIDTH = 4 };
+
+    __m128 v;
+
+    VFloat4() {}
+    explicit VFloat4(__m128 x) : v(x) {}
+
+    static VFloat4 zero() { return VFloat4(_mm_setzero_ps()); }
+    static VFloat4 set1(float f) { return VFloat4(_mm_set1_ps(f)); }
+    static VFloat4 load(const float* p) { return VFloat4(_mm_loadu_ps(p)); }
+    static void store(float* p, VFloat4 a) { _mm_storeu_ps(p, a.v); }
+
+    static VFloat4 load(const Float16* p)
+    {
+#if defined(__F16C__)
+        return VFloat4(_mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)p)));
+#else
+        return VFloat4(_mm_setr_ps(from_float16(p[0]), from_float16(p[1]), from_float16(p[2]), from_float16(p[3])));
+#endif
+    }
+
+    static void store(Float16* p, VFloat4 a)
+    {
+#if defined(__F16C__)
+        _mm_storel_epi64((__m128i*)p, _mm_cvtps_ph(a.v, 0));
+#else
+        float tmp[4];
+        _mm_storeu_ps(tmp, a.v);
+        for(int l = 0; l < 4; ++l)
+            p[l] = to_float16(tmp[l]);
+#endif
+    }
+
+    static VFloat4 load(const Q8_8* p)
+    {
+        __m128i i = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+        return VFloat4(_mm_mul_ps(_mm_cvtepi32_ps(i), _mm_set1_ps(1.0f/256.0f)));
+    }
+
+    static void store(Q8_8* p, VFloat4 a)
+    {
+        __m128 x = _mm_add_ps(_mm_mul_ps(a.v, _mm_set1_ps(256.0f)), _mm_set1_ps(0.5f));
+        x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(65535.0f));
+        // no unsigned saturating pack in SSE2, shift into the signed range and back
+        __m128i i = _mm_sub_epi32(_mm_cvttps_epi32(x), _mm_set1_epi32(32768));
+        i = _mm_add_epi16(_mm_packs_epi32(i, i), _mm_set1_epi16((short)0x8000));
+        _mm_storel_epi64((__m128i*)p, i);
+    }
+
+    static VFloat4 load_u8(const unsigned char* p, int stride = 1)
+    {
+        return VFloat4(_mm_setr_ps(p[0], p[stride], p[2*stride], p[3*stride]));
+    }
+
+    static void store_u8(unsigned char* p, VFloat4 a, int stride = 1)
+    {
+        __m128i i = _mm_cvttps_epi32(a.v);
+        int tmp[4];
+        _mm_storeu_si128((__m128i*)tmp, i);
+        for(int l = 0; l < 4; ++l)
+            p[l*stride] = (unsigned char)tmp[l];
+    }
+};
+
+inline VFloat4 operator+(VFloat4 a, VFloat4 b) { return VFloat4(_mm_add_ps(a.v, b.v)); }
+inline VFloat4 operator-(VFloat4 a, VFloat4 b) { return VFloat4(_mm_sub_ps(a.v, b.v)); }
+inline VFloat4 operator*(VFloat4 a, VFloat4 b) { return VFloat4(_mm_mul_ps(a.v, b.v)); }
+inline VFloat4 operator/(VFloat4 a, VFloat4 b) { return VFloat4(_mm_div_ps(a.v, b.v)); }
+inline MaskF4 operator<(VFloat4 a, VFloat4 b) { return MaskF4(_mm_cmplt_ps(a.v, b.v)); }
+inline MaskF4 operator>(VFloat4 a, VFloat4 b) { return MaskF4(_mm_cmpgt_ps(a.v, b.v)); }
+inline MaskF4 operator==(VFloat4 a, VFloat4 b) { return MaskF4(_mm_cmpeq_ps(a.v, b.v)); }
+inline VFloat4 v_sqrt(VFloat4 a) { return VFloat4(_mm_sqrt_ps(a.v)); }
+inline VFloat4 v_min(VFloat4 a, VFloat4 b) { return VFloat4(_mm_min_ps(a.v, b.v)); }
+inline VFloat4 v_max(VFloat4 a, VFloat4 b) { return VFloat4(_mm_max_ps(a.v, b.v)); }
+inline VFloat4 v_select(MaskF4 m, VFloat4 a, VFloat4 b)
+{
+    return VFloat4(_mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)));
+}
+
+inline void v_store_mask_u8(unsigned char* p, MaskF4 m, unsigned char a, unsigned char b)
+{
+    int bits = _mm_movemask_ps(m.m);
+    for(int l = 0; l < 4; ++l)
+        p[l] = ((bits >> l) & 1) ? a : b;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// SSE2 unsigned 16-bit (8 lanes)
+
+struct MaskU8
+{
+    __m128i m;
+
+    MaskU8() {}
+    explicit MaskU8(__m128i x) : m(x) {}
+
+    static MaskU8 none() { return MaskU8(_mm_setzero_si128()); }
+    bool any() const { return _mm_movemask_epi8(m) != 0; }
+    bool lane(int i) const { return (_mm_movemask_epi8(m) >> (2*i)) & 1; }
+};
+
+inline MaskU8 operator&(MaskU8 a, MaskU8 b) { return MaskU8(_mm_and_si128(a.m, b.m)); }
+inline MaskU8 operator|(MaskU8 a, MaskU8 b) { return MaskU8(_mm_or_si128(a.m, b.m)); }
+inline MaskU8 operator~(MaskU8 a) { return MaskU8(_mm_xor_si128(a.m, _mm_set1_epi32(-1))); }
+
+struct VU16x8
+{
+    typedef MaskU8 Mask;
+    enum { WIDTH = 8 };
+
+    __m128i v;
+
+    VU16x8() {}
+    explicit VU16x8(__m128i x) : v(x) {}
+
+    static VU16x8 zero() { return VU16x8(_mm_setzero_si128()); }
+    static VU16x8 set1(unsigned short x) { return VU16x8(_mm_set1_epi16((short)x)); }
+    static VU16x8 load(const unsigned short* p) { return VU16x8(_mm_loadu_si128((const __m128i*)p)); }
+    static void store(unsigned short* p, VU16x8 a) { _mm_storeu_si128((__m128i*)p, a.v); }
+
+    static VU16x8 load_u8(const unsigned char* p, int stride = 1)
+    {
+        if(stride == 1)
+            return VU16x8(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()));
+
+        return VU16x8(_mm_setr_epi16(p[0], p[stride], p[2*stride], p[3*stride],
+                                     p[4*stride], p[5*stride], p[6*stride], p[7*stride]));
+    }
+
+    static void store_u8(unsigned char* p, VU16x8 a, int stride = 1)
+    {
+        __m128i b = _mm_packus_epi16(a.v, a.v);
+        if(stride == 1)
+        {
+            _mm_storel_epi64((__m128i*)p, b);
+            return;
+        }
+
+        unsigned char tmp[16];
+        _mm_storeu_si128((__m128i*)tmp, b);
+        for(int l = 0; l < 8; ++l)
+            p[l*stride] = tmp[l];
+    }
+};
+
+// SSE2 only compares signed words, flipping the top bit maps unsigned order onto signed order
+inline __m128i v_flip_u16(__m128i a) { return _mm_xor_si128(a, _mm_set1_epi16((short)0x8000)); }
+
+inline VU16x8 operator+(VU16x8 a, VU16x8 b) { return VU16x8(_mm_add_epi16(a.v, b.v)); }
+inline VU16x8 operator-(VU16x8 a, VU16x8 b) { return VU16x8(_mm_sub_epi16(a.v, b.v)); }
+inline VU16x8 v_shl(VU16x8 a, int n) { return VU16x8(_mm_slli_epi16(a.v, n)); }
+inline VU16x8 v_shr(VU16x8 a, int n) { return VU16x8(_mm_srli_epi16(a.v, n)); }
+inline VU16x8 v_adds(VU16x8 a, VU16x8 b) { return VU16x8(_mm_adds_epu16(a.v, b.v)); }
+inline VU16x8 v_subs(VU16x8 a, VU16x8 b) { return VU16x8(_mm_subs_epu16(a.v, b.v)); }
+inline VU16x8 v_mulhi(VU16x8 a, VU16x8 b) { return VU16x8(_mm_mulhi_epu16(a.v, b.v)); }
+inline VU16x8 v_mullo(VU16x8 a, VU16x8 b) { return VU16x8(_mm_mullo_epi16(a.v, b.v)); }
+inline VU16x8 v_mulhi_round(VU16x8 a, VU16x8 b)
+{
+    // the rounding carry into the high half is the top bit of the low half
+    return VU16x8(_mm_add_epi16(_mm_mulhi_epu16(a.v, b.v), _mm_srli_epi16(_mm_mullo_epi16(a.v, b.v), 15)));
+}
+inline MaskU8 operator<(VU16x8 a, VU16x8 b) { return MaskU8(_mm_cmplt_epi16(v_flip_u16(a.v), v_flip_u16(b.v))); }
+inline MaskU8 operator>(VU16x8 a, VU16x8 b) { return MaskU8(_mm_cmpgt_epi16(v_flip_u16(a.v), v_flip_u16(b.v))); }
+inline MaskU8 operator==(VU16x8 a, VU16x8 b) { return MaskU8(_mm_cmpeq_epi16(a.v, b.v)); }
+inline VU16x8 v_min(VU16x8 a, VU16x8 b) { return VU16x8(_mm_subs_epu16(a.v, _mm_subs_epu16(a.v, b.v))); }
+inline VU16x8 v_max(VU16x8 a, VU16x8 b) { return VU16x8(_mm_adds_epu16(b.v, _mm_subs_epu16(a.v, b.v))); }
+inline VU16x8 v_absdiff(VU16x8 a, VU16x8 b) { return VU16x8(_mm_or_si128(_mm_subs_epu16(a.v, b.v), _mm_subs_epu16(b.v, a.v))); }
+inline VU16x8 v_select(MaskU8 m, VU16x8 a, VU16x8 b)
+{
+    return VU16x8(_mm_or_si128(_mm_and_si128(m.m, a.v), _mm_andnot_si128(m.m, b.v)));
+}
+
+inline void v_store_mask_u8(unsigned char* p, MaskU8 m, unsigned char a, unsigned char b)
+{
+    __m128i bytes = _mm_packs_epi16(m.m, m.m);
+    __m128i out = _mm_or_si128(_mm_and_si128(bytes, _mm_set1_epi8((char)a)), _mm_andnot_si128(bytes, _mm_set1_epi8((char)b)));
+    _mm_storel_epi64((__m128i*)p, out);
+}
+
+// SSE2 unsigned 8-bit (16 lanes)
+
+struct VU8x16
+{
+    enum { WIDTH = 16 };
+
+    __m128i v;
+
+    VU8x16() {}
+    explicit VU8x16(__m128i x) : v(x) {}
+
+    static VU8x16 zero() { return VU8x16(_mm_setzero_si128()); }
+    static VU8x16 set1(unsigned char x) { return VU8x16(_mm_set1_epi8((char)x)); }
+    static VU8x16 load(const unsigned char* p) { return VU8x16(_mm_loadu_si128((const __m128i*)p)); }
+    static void store(unsigned char* p, VU8x16 a) { _mm_storeu_si128((__m128i*)p, a.v); }
+};
+
+inline VU8x16 operator|(VU8x16 a, VU8x16 b) { return VU8x16(_mm_or_si128(a.v, b.v)); }
+inline VU8x16 operator&(VU8x16 a, VU8x16 b) { return VU8x16(_mm_and_si128(a.v, b.v)); }
+inline VU8x16 operator~(VU8x16 a) { return VU8x16(_mm_xor_si128(a.v, _mm_set1_epi32(-1))); }
+inline VU8x16 operator+(VU8x16 a, VU8x16 b) { return VU8x16(_mm_add_epi8(a.v, b.v)); }
+inline VU8x16 operator-(VU8x16 a, VU8x16 b) { return VU8x16(_mm_sub_epi8(a.v, b.v)); }
+inline VU8x16 operator==(VU8x16 a, VU8x16 b) { return VU8x16(_mm_cmpeq_epi8(a.v, b.v)); }
+// a > b exactly when a - b does not saturate to zero
+inline VU8x16 operator>(VU8x16 a, VU8x16 b) { return ~VU8x16(_mm_cmpeq_epi8(_mm_subs_epu8(a.v, b.v), _mm_setzero_si128())); }
+inline VU8x16 v_min(VU8x16 a, VU8x16 b) { return VU8x16(_mm_min_epu8(a.v, b.v)); }
+inline VU8x16 v_max(VU8x16 a, VU8x16 b) { return VU8x16(_mm_max_epu8(a.v, b.v)); }
+inline VU8x16 v_absdiff(VU8x16 a, VU8x16 b) { return VU8x16(_mm_or_si128(_mm_subs_epu8(a.v, b.v), _mm_subs_epu8(b.v, a.v))); }
+inline VU8x16 v_select(VU8x16 m, VU8x16 a, VU8x16 b) { return VU8x16(_mm_or_si128(_mm_and_si128(m.v, a.v), _mm_andnot_si128(m.v, b.v))); }
+inline bool v_any(VU8x16 a) { return _mm_movemask_epi8(_mm_cmpeq_epi8(a.v, _mm_setzero_si128())) != 0xffff; }
+
+// Four rounds of interleaving bytes with the other half of a neighbouring register take
+// 48 interleaved bytes apart into 3 channels; v_interleave3 undoes the rounds one by one.
+inline void v_deinterleave3(__m128i& t0, __m128i& t1, __m128i& t2)
+{
+    for(int round = 0; round < 4; ++round)
+    {
+        __m128i u0 = _mm_unpacklo_epi8(t0, _mm_unpackhi_epi64(t1, t1));
+        __m128i u1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t0, t0), t2);
+        __m128i u2 = _mm_unpacklo_epi8(t1, _mm_unpackhi_epi64(t2, t2));
+        t0 = u0;
+        t1 = u1;
+        t2 = u2;
+    }
+}
+
+inline void v_interleave3(__m128i& u0, __m128i& u1, __m128i& u2)
+{
+    const __m128i even = _mm_set1_epi16(0x00ff);
+    for(int round = 0; round < 4; ++round)
+    {
+        __m128i t0 = _mm_packus_epi16(_mm_and_si128(u0, even), _mm_and_si128(u1, even));
+        __m128i t1 = _mm_packus_epi16(_mm_and_si128(u2, even), _mm_srli_epi16(u0, 8));
+        __m128i t2 = _mm_packus_epi16(_mm_srli_epi16(u1, 8), _mm_srli_epi16(u2, 8));
+        u0 = t0;
+        u1 = t1;
+        u2 = t2;
+    }
+}
+
+inline void v_deinterleave3(VU8x16 a0, VU8x16 a1, VU8x16 a2, VU8x16& x, VU8x16& y, VU8x16& z)
+{
+    v_deinterleave3(a0.v, a1.v, a2.v);
+    x = a0;
+    y = a1;
+    z = a2;
+}
+
+inline void v_interleave3(VU8x16 x, VU8x16 y, VU8x16 z, VU8x16& a0, VU8x16& a1, VU8x16& a2)
+{
+    v_interleave3(x.v, y.v, z.v);
+    a0 = x;
+    a1 = y;
+    a2 = z;
+}
+
+#endif
+
+#if defined(__AVX__)
+
+/////////////////////////////////////////////////////////////////////////////
+// AVX (8 lanes)
+
+struct MaskF8
+{
+    __m256 m;
+
+    MaskF8() {}
+    explicit MaskF8(__m256 x) : m(x) {}
+
+    static MaskF8 none() { return MaskF8(_mm256_setzero_ps()); }
+    bool any() const { return _mm256_movemask_ps(m) != 0; }
+    bool lane(int i) const { return (_mm256_movemask_ps(m) >> i) & 1; }
+};
+
+inline MaskF8 operator&(MaskF8 a, MaskF8 b) { return MaskF8(_mm256_and_ps(a.m, b.m)); }
+inline MaskF8 operator|(MaskF8 a, MaskF8 b) { return MaskF8(_mm256_or_ps(a.m, b.m)); }
+inline MaskF8 operator~(MaskF8 a) { return MaskF8(_mm256_xor_ps(a.m, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))); }
+
+struct VFloat8
+{
+    typedef MaskF8 Mask;
+    enum { WIDTH = 8 };
+
+    __m256 v;
+
+    VFloat8() {}
+    explicit VFloat8(__m256 x) : v(x) {}
+
+    static VFloat8 zero() { return VFloat8(_mm256_setzero_ps()); }
+    static VFloat8 set1(float f) { return VFloat8(_mm256_set1_ps(f)); }
+    static VFloat8 load(const float* p) { return VFloat8(_mm256_loadu_ps(p)); }
+    static void store(float* p, VFloat8 a) { _mm256_storeu_ps(p, a.v); }
+
+    static VFloat8 load(const Float16* p)
+    {
+#if defined(__F16C__)
+        return VFloat8(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p)));
+#else
+        float tmp[8];
+        for(int l = 0; l < 8; ++l)
+            tmp[l] = from_float16(p[l]);
+        return VFloat8(_mm256_loadu_ps(tmp));
+#endif
+    }
+
+    static void store(Float16* p, VFloat8 a)
+    {
+#if defined(__F16C__)
+        _mm_storeu_si128((__m128i*)p, _mm256_cvtps_ph(a.v, 0));
+#else
+        float tmp[8];
+        _mm256_storeu_ps(tmp, a.v);
+        for(int l = 0; l < 8; ++l)
+            p[l] = to_float16(tmp[l]);
+#endif
+    }
+
+    static VFloat8 load(const Q8_8* p)
+    {
+        // AVX has no 256-bit integer instructions, convert each half with SSE2
+        __m128i i = _mm_loadu_si128((const __m128i*)p);
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(i, _mm_setzero_si128()));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(i, _mm_setzero_si128()));
+        return VFloat8(_mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1), _mm256_set1_ps(1.0f/256.0f)));
+    }
+
+    static void store(Q8_8* p, VFloat8 a)
+    {
+        __m256 x = _mm256_add_ps(_mm256_mul_ps(a.v, _mm256_set1_ps(256.0f)), _mm256_set1_ps(0.5f));
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(65535.0f));
+        __m256i i = _mm256_cvttps_epi32(x);
+        __m128i lo = _mm_sub_epi32(_mm256_castsi256_si128(i), _mm_set1_epi32(32768));
+        __m128i hi = _mm_sub_epi32(_mm256_extractf128_si256(i, 1), _mm_set1_epi32(32768));
+        _mm_storeu_si128((__m128i*)p, _mm_add_epi16(_mm_packs_epi32(lo, hi), _mm_set1_epi16((short)0x8000)));
+    }
+
+    static VFloat8 load_u8(const unsigned char* p, int stride = 1)
+    {
+        return VFloat8(_mm256_setr_ps(p[0], p[stride], p[2*stride], p[3*stride],
+                                      p[4*stride], p[5*stride], p[6*stride], p[7*stride]));
+    }
+
+    static void store_u8(unsigned char* p, VFloat8 a, int stride = 1)
+    {
+        __m256i i = _mm256_cvttps_epi32(a.v);
+        int tmp[8];
+        _mm256_storeu_si256((__m256i*)tmp, i);
+        for(int l = 0; l < 8; ++l)
+            p[l*stride] = (unsigned char)tmp[l];
+    }
+};
+
+inline VFloat8 operator+(VFloat8 a, VFloat8 b) { return VFloat8(_mm256_add_ps(a.v, b.v)); }
+inline VFloat8 operator-(VFloat8 a, VFloat8 b) { return VFloat8(_mm256_sub_ps(a.v, b.v)); }
+inline VFloat8 operator*(VFloat8 a, VFloat8 b) { return VFloat8(_mm256_mul_ps(a.v, b.v)); }
+inline VFloat8 operator/(VFloat8 a, VFloat8 b) { return VFloat8(_mm256_div_ps(a.v, b.v)); }
+inline MaskF8 operator<(VFloat8 a, VFloat8 b) { return MaskF8(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline MaskF8 operator>(VFloat8 a, VFloat8 b) { return MaskF8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+inline MaskF8 operator==(VFloat8 a, VFloat8 b) { return MaskF8(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+inline VFloat8 v_sqrt(VFloat8 a) { return VFloat8(_mm256_sqrt_ps(a.v)); }
+inline VFloat8 v_min(VFloat8 a, VFloat8 b) { return VFloat8(_mm256_min_ps(a.v, b.v)); }
+inline VFloat8 v_max(VFloat8 a, VFloat8 b) { return VFloat8(_mm256_max_ps(a.v, b.v)); }
+inline VFloat8 v_select(MaskF8 m, VFloat8 a, VFloat8 b) { return VFloat8(_mm256_blendv_ps(b.v, a.v, m.m)); }
+
+inline void v_store_mask_u8(unsigned char* p, MaskF8 m, unsigned char a, unsigned char b)
+{
+    int bits = _mm256_movemask_ps(m.m);
+    for(int l = 0; l < 8; ++l)
+        p[l] = ((bits >> l) & 1) ? a : b;
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+/////////////////////////////////////////////////////////////////////////////
+// AVX2 unsigned 8-bit (32 lanes)
+
+struct VU8x32
+{
+    enum { WIDTH = 32 };
+
+    __m256i v;
+
+    VU8x32() {}
+    explicit VU8x32(__m256i x) : v(x) {}
+
+    static VU8x32 zero() { return VU8x32(_mm256_setzero_si256()); }
+    static VU8x32 set1(unsigned char x) { return VU8x32(_mm256_set1_epi8((char)x)); }
+    static VU8x32 load(const unsigned char* p) { return VU8x32(_mm256_loadu_si256((const __m256i*)p)); }
+    static void store(unsigned char* p, VU8x32 a) { _mm256_storeu_si256((__m256i*)p, a.v); }
+};
+
+inline VU8x32 operator|(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_or_si256(a.v, b.v)); }
+inline VU8x32 operator&(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_and_si256(a.v, b.v)); }
+inline VU8x32 operator~(VU8x32 a) { return VU8x32(_mm256_xor_si256(a.v, _mm256_set1_epi32(-1))); }
+inline VU8x32 operator+(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_add_epi8(a.v, b.v)); }
+inline VU8x32 operator-(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_sub_epi8(a.v, b.v)); }
+inline VU8x32 operator==(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_cmpeq_epi8(a.v, b.v)); }
+inline VU8x32 operator>(VU8x32 a, VU8x32 b) { return ~VU8x32(_mm256_cmpeq_epi8(_mm256_subs_epu8(a.v, b.v), _mm256_setzero_si256())); }
+inline VU8x32 v_min(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_min_epu8(a.v, b.v)); }
+inline VU8x32 v_max(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_max_epu8(a.v, b.v)); }
+inline VU8x32 v_absdiff(VU8x32 a, VU8x32 b) { return VU8x32(_mm256_or_si256(_mm256_subs_epu8(a.v, b.v), _mm256_subs_epu8(b.v, a.v))); }
+inline VU8x32 v_select(VU8x32 m, VU8x32 a, VU8x32 b) { return VU8x32(_mm256_blendv_epi8(b.v, a.v, m.v)); }
+inline bool v_any(VU8x32 a) { return !_mm256_testz_si256(a.v, a.v); }
+
+// The 96 bytes are taken apart as two blocks of 48 with the SSE2 rounds, since the AVX2
+// byte unpacks do not cross the 128-bit halves.
+inline void v_deinterleave3(VU8x32 a0, VU8x32 a1, VU8x32 a2, VU8x32& x, VU8x32& y, VU8x32& z)
+{
+    __m128i t0 = _mm256_castsi256_si128(a0.v), t1 = _mm256_extracti128_si256(a0.v, 1), t2 = _mm256_castsi256_si128(a1.v);
+    __m128i t3 = _mm256_extracti128_si256(a1.v, 1), t4 = _mm256_castsi256_si128(a2.v), t5 = _mm256_extracti128_si256(a2.v, 1);
+    v_deinterleave3(t0, t1, t2);
+    v_deinterleave3(t3, t4, t5);
+    x = VU8x32(_mm256_inserti128_si256(_mm256_castsi128_si256(t0), t3, 1));
+    y = VU8x32(_mm256_inserti128_si256(_mm256_castsi128_si256(t1), t4, 1));
+    z = VU8x32(_mm256_inserti128_si256(_mm256_castsi128_si256(t2), t5, 1));
+}
+
+inline void v_interleave3(VU8x32 x, VU8x32 y, VU8x32 z, VU8x32& a0, VU8x32& a1, VU8x32& a2)
+{
+    __m128i t0 = _mm256_castsi256_si128(x.v), t1 = _mm256_castsi256_si128(y.v), t2 = _mm256_castsi256_si128(z.v);
+    __m128i t3 = _mm256_extracti128_si256(x.v, 1), t4 = _mm256_extracti128_si256(y.v, 1), t5 = _mm256_extracti128_si256(z.v, 1);
+    v_interleave3(t0, t1, t2);
+    v_interleave3(t3, t4, t5);
+    a0 = VU8x32(_mm256_inserti128_si256(_mm256_castsi128_si256(t0), t1, 1));
+    a1 = VU8x32(_mm256_inserti128_si256(_mm256_castsi128_si256(t2), t3, 1));
+    a2 = VU8x32(_mm256_inserti128_si256(_mm256_castsi128_si256(t4), t5, 1));
+}
+
+#endif
+
+// widest float vector available for this build
+#if defined(__AVX__)
+typedef VFloat8 VFloat;
+#elif defined(__SSE2__)
+typedef VFloat4 VFloat;
+#else
+typedef VFloat1 VFloat;
+#endif
+
+// widest unsigned 16-bit vector available for this build
+#if defined(__SSE2__)
+typedef VU16x8 VU16;
+#else
+typedef VU16x1 VU16;
+#endif
+
+// widest unsigned 8-bit vector available for this build
+#if defined(__AVX2__)
+typedef VU8x32 VU8;
+#elif defined(__SSE2__)
+typedef VU8x16 VU8;
+#else
+typedef VU8x1 VU8;
+#endif
+
+// Widest instruction set the library was built for: "avx2", "avx", "sse2" or "none". It is
+// defined in Simd.cpp, so it reports the flags the library was compiled with, which need not
+// be those of the code calling it.
+const char* Level();
+
+}
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "SimpleFrameDifferencing.hpp"
+#include "Simd.hpp"
+
+#include <string.h>
 
 using namespace bgs;
 
@@ -6,12 +9,14 @@ SimpleFrameDifferencing::SimpleFrameDifferencing()
 {
     m_params = SimpleFrameDifferencingParams();
     m_frame_num = 0;
+    m_next = 0;
 }
 
 SimpleFrameDifferencing::SimpleFrameDifferencing(const BgsParams &p)
 {
     m_params = (SimpleFrameDifferencingParams&)p;
     m_frame_num = 0;
+    m_next = 0;
 }
 
 SimpleFrameDifferencing::~SimpleFrameDifferencing()
@@ -21,19 +26,20 @@ SimpleFrameDifferencing::~SimpleFrameDifferencing()
 
 void SimpleFrameDifferencing::Initalize(const cv::Mat& image)
 {
-    if(image.type() != CV_8UC3)
-        CV_Error( CV_StsUnsupportedFormat, "Only 3-channel 8-bit images are supported in libBGS" );
+    if(image.type() != CV_8UC1 && image.type() != CV_8UC3)
+        CV_Error( CV_StsUnsupportedFormat, "Only 1-channel or 3-channel 8-bit images are supported in libBGS" );
+
+    if(m_params.Offset() < 0)
+        CV_Error( CV_StsOutOfRange, "Offset() must not be negative" );
 
     m_params.SetFrameSize(image.cols, image.rows);
     m_params.Channels() = image.channels();
 
-    m_frameBuffer.empty();
-
     // fill the frame buffer
-    for(int i = 0; i <= m_params.Offset(); i++)
-    {
-        m_frameBuffer.push(image.clone());
-    }
+    m_frameBuffer.resize(m_params.Offset() + 1);
+    for(size_t i = 0; i < m_frameBuffer.size(); i++)
+        image.copyTo(m_frameBuffer[i]);
+    m_next = 0;
 }
 
 void SimpleFrameDifferencing::Save(std::string file)
@@ -46,6 +52,28 @@ void SimpleFrameDifferencing::Load(std::string file)
 
 }
 
+namespace
+{
+
+// Squared distance between the pixels of two frames over the channels, compared against
+// both thresholds. The squares of 8-bit differences add up exactly in float.
+template<class V, int CHANNELS>
+void SubtractPixels(const unsigned char* pixels, const unsigned char* reference, unsigned char* low,
+                    unsigned char* high, const V& low_threshold, const V& high_threshold)
+{
+    V dist = V::zero();
+    for(int ch = 0; ch < CHANNELS; ++ch)
+    {
+        V diff = V::load_u8(pixels + ch, CHANNELS) - V::load_u8(reference + ch, CHANNELS);
+        dist = dist + diff*diff;
+    }
+
+    v_store_mask_u8(low, dist > low_threshold, Bgs::FOREGROUND, Bgs::BACKGROUND);
+    v_store_mask_u8(high, dist > high_threshold, Bgs::FOREGROUND, Bgs::BACKGROUND);
+}
+
+}
+
 void SimpleFrameDifferencing::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
     if(m_frame_num == 0)
@@ -57,28 +85,28 @@ void SimpleFrameDifferencing::Subtract(const cv::Mat& image, cv::Mat& low_thresh
     if(high_threshold_mask.empty())
         high_threshold_mask.create(m_params.Height(), m_params.Width(), CV_8U);
 
-    // maintain buffer
-    m_frameBuffer.push(image.clone());
-    m_frameBuffer.pop();
+    // the frame goes into the slot of the oldest one, and is compared with the one after it
+    // in the ring, which is Offset() frames older (itself when Offset() is 0)
+    const int slots = (int)m_frameBuffer.size();
+    cv::Mat& frame = m_frameBuffer[m_next];
+    m_next = (m_next + 1) % slots;
+    const cv::Mat& reference = m_frameBuffer[m_next];
 
-    unsigned char low_threshold, high_threshold;
-
-    // update each pixel of the image
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    // copy and compare each row of the image, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        const size_t rowBytes = m_params.Width()*m_params.Channels();
+
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // perform background subtraction
+            memcpy(frame.ptr<unsigned char>(r), image.ptr<unsigned char>(r), rowBytes);
+
             if(m_params.Channels() == 3)
-                SubtractPixel(r, c, image.at<cv::Vec3b>(r,c), low_threshold, high_threshold);
+                SubtractRow<3>(r, image, reference, low_threshold_mask, high_threshold_mask);
             else
-                SubtractPixel(r, c, image.at<unsigned char>(r,c), low_threshold, high_threshold);
-
-            // setup silhouette mask
-            low_threshold_mask.at<unsigned char>(r,c) = low_threshold;
-            high_threshold_mask.at<unsigned char>(r,c) = high_threshold;
+                SubtractRow<1>(r, image, reference, low_threshold_mask, high_threshold_mask);
         }
-    }
+    });
 
     m_frame_num++;
 }
@@ -88,46 +116,25 @@ void SimpleFrameDifferencing::Update(const cv::Mat& image,  const cv::Mat& updat
     // it doesn't make sense to have conditional updates in this framework
 }
 
-void SimpleFrameDifferencing::SubtractPixel(int r, int c, const cv::Vec3b& pixel, unsigned char& low_threshold, unsigned char& high_threshold)
+template<int CHANNELS>
+void SimpleFrameDifferencing::SubtractRow(int r, const cv::Mat& image, const cv::Mat& reference,
+                                          cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
-    // calculate distance to sample point
-    float dist = 0;
-    for(int ch = 0; ch < 3; ++ch)
-    {
-        dist += (pixel[ch] - m_frameBuffer.front().at<cv::Vec3b>(r,c)[ch]) * (pixel[ch] - m_frameBuffer.front().at<cv::Vec3b>(r,c)[ch]);
-    }
-
-    // determine if sample point is F/G or B/G pixel
-    low_threshold = BACKGROUND;
-    if(dist > m_params.LowThreshold())
-    {
-        low_threshold = FOREGROUND;
-    }
-
-    high_threshold = BACKGROUND;
-    if(dist > m_params.HighThreshold())
-    {
-        high_threshold = FOREGROUND;
-    }
+    typedef simd::VFloat V;
+    typedef simd::VFloat1 V1;
+
+    const V low = V::set1(m_params.LowThreshold()), high = V::set1(m_params.HighThreshold());
+    const V1 low1 = V1::set1(m_params.LowThreshold()), high1 = V1::set1(m_params.HighThreshold());
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    const unsigned char* previous = reference.ptr<unsigned char>(r);
+    unsigned char* lowMask = low_threshold_mask.ptr<unsigned char>(r);
+    unsigned char* highMask = high_threshold_mask.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        SubtractPixels<V, CHANNELS>(pixels + CHANNELS*c, previous + CHANNELS*c, lowMask + c, highMask + c, low, high);
+    for(; c < width; ++c)
+        SubtractPixels<V1, CHANNELS>(pixels + CHANNELS*c, previous + CHANNELS*c, lowMask + c, highMask + c, low1, high1);
 }
-
-void SimpleFrameDifferencing::SubtractPixel(int r, int c, const unsigned char pixel, unsigned char& low_threshold, unsigned char& high_threshold)
-{
-    // calculate distance to sample point
-    float dist = (pixel - m_frameBuffer.front().at<unsigned char>(r,c)) * (pixel - m_frameBuffer.front().at<unsigned char>(r,c));
-
-    // determine if sample point is F/G or B/G pixel
-    low_threshold = BACKGROUND;
-    if(dist > m_params.LowThreshold())
-    {
-        low_threshold = FOREGROUND;
-    }
-
-    high_threshold = BACKGROUND;
-    if(dist > m_params.HighThreshold())
-    {
-        high_threshold = FOREGROUND;
-    }
-}
-
-
@@ -13,7 +13,7 @@
 #define SIMPLEFRAMEDIFF_
 
 #include "Bgs.hpp"
-#include <queue>
+#include <vector>
 
 namespace bgs
 {
@@ -28,6 +28,7 @@ public:
         m_high_threshold = 2*m_low_threshold; // Note: high threshold is used by post-processing
     }
 
+    // number of frames back the frame each frame is compared with
     int &Offset() { return m_offset; }
 
     void write(cv::FileStorage& fs) const {} // write serialization
@@ -57,15 +58,22 @@ public:
     void Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
     void Update(const cv::Mat& image,  const cv::Mat& update_mask);
 
-    cv::Mat Background() { return m_frameBuffer.front(); }
+    // the frame the last frame was compared with
+    cv::Mat Background() { return m_frameBuffer[m_next]; }
 
 private:
     void Initalize(const cv::Mat& image);
-    void SubtractPixel(int r, int c, const cv::Vec3b& pixel, unsigned char& low_threshold, unsigned char& high_threshold);
-    void SubtractPixel(int r, int c, const unsigned char pixel, unsigned char& low_threshold, unsigned char& high_threshold);
+
+    template<int CHANNELS>
+    void SubtractRow(int r, const cv::Mat& image, const cv::Mat& reference, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
 
     SimpleFrameDifferencingParams m_params;
-    std::queue<cv::Mat> m_frameBuffer;
+
+    // ring of the last Offset()+1 frames, allocated once; each frame is copied into the slot
+    // of the oldest one
+    std::vector<cv::Mat> m_frameBuffer;
+    // slot the next frame goes into, which holds the frame Offset() frames before the last one
+    int m_next;
 };
 
 }
@@ -0,0 +1,246 @@
+#include "SnapshotPca.hpp"
+#include "ThreadPool.hpp"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace bgs;
+
+namespace
+{
+
+// values of a frame handled by one task; 4096 products of 8-bit values fit in 32 bits
+const int GRAM_BLOCK = 4096;
+// values of the eigenvectors built by one task, small enough for the sums to stay in cache
+const int PROJECT_BLOCK = 256;
+
+}
+
+SnapshotPca::SnapshotPca()
+{
+    m_count = 0;
+    m_next = 0;
+}
+
+void SnapshotPca::Initalize(int frames, int dims)
+{
+    m_frames.create(frames, dims, CV_8U);
+    m_gram = cv::Mat::zeros(frames, frames, CV_64F);
+    m_count = 0;
+    m_next = 0;
+}
+
+SnapshotPca SnapshotPca::Clone() const
+{
+    SnapshotPca copy(*this);
+    copy.m_frames = m_frames.clone();
+    copy.m_gram = m_gram.clone();
+    return copy;
+}
+
+void SnapshotPca::Add(const cv::Mat& image, unsigned int threads)
+{
+    CV_Assert(image.depth() == CV_8U && (int)(image.total()*image.channels()) == m_frames.cols);
+
+    const int slot = m_next;
+    unsigned char* frame = m_frames.ptr<unsigned char>(slot);
+    const size_t row_bytes = image.cols*image.channels();
+    for(int r = 0; r < image.rows; ++r)
+        memcpy(frame + r*row_bytes, image.ptr<unsigned char>(r), row_bytes);
+
+    m_next = (m_next + 1) % m_frames.rows;
+    m_count = std::min(m_count + 1, m_frames.rows);
+
+    // dot products of the new frame with every frame in the ring, itself included, a block
+    // of values at a time; the sums are exact so the order they are added in does not matter
+    const int dims = m_frames.cols;
+    const int blocks = (dims + GRAM_BLOCK - 1) / GRAM_BLOCK;
+    std::vector<int64_t> partial((size_t)blocks*m_count);
+
+    ParallelRows(blocks, threads, [&](int block_begin, int block_end)
+    {
+        for(int b = block_begin; b < block_end; ++b)
+        {
+            const int begin = b*GRAM_BLOCK;
+            const int end = std::min(begin + GRAM_BLOCK, dims);
+            for(int j = 0; j < m_count; ++j)
+            {
+                const unsigned char* other = m_frames.ptr<unsigned char>(j);
+                uint32_t sum = 0;
+                for(int i = begin; i < end; ++i)
+                    sum += frame[i]*other[i];
+                partial[(size_t)b*m_count + j] = sum;
+            }
+        }
+    });
+
+    for(int j = 0; j < m_count; ++j)
+    {
+        int64_t sum = 0;
+        for(int b = 0; b < blocks; ++b)
+            sum += partial[(size_t)b*m_count + j];
+        m_gram.at<double>(slot, j) = m_gram.at<double>(j, slot) = (double)sum;
+    }
+}
+
+void SnapshotPca::Compute(cv::PCA& pca, int max_components, double retained_variance, int depth,
+                          unsigned int threads) const
+{
+    const int n = m_count;
+    CV_Assert(n > 0 && (depth == CV_32F || depth == CV_64F));
+
+    // Gram matrix of the frames minus their mean: G - r 1' - 1 r' + s, with r the mean of
+    // each row of G and s the mean of all of G
+    std::vector<double> row_mean(n, 0.0);
+    double mean = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        const double* gram = m_gram.ptr<double>(i);
+        for(int j = 0; j < n; ++j)
+            row_mean[i] += gram[j];
+        row_mean[i] /= n;
+        mean += row_mean[i];
+    }
+    mean /= n;
+
+    cv::Mat centred(n, n, CV_64F);
+    for(int i = 0; i < n; ++i)
+    {
+        const double* gram = m_gram.ptr<double>(i);
+        double* c = centred.ptr<double>(i);
+        for(int j = 0; j < n; ++j)
+            c[j] = gram[j] - row_mean[i] - row_mean[j] + mean;
+    }
+
+    // descending eigenvalues, eigenvectors as rows
+    cv::Mat values, vectors;
+    cv::eigen(centred, values, vectors);
+
+    // number of components, chosen the way cv::PCA does
+    int components;
+    if(max_components > 0)
+    {
+        components = std::min(max_components, n);
+    }
+    else
+    {
+        double total = 0;
+        for(int i = 0; i < n; ++i)
+            total += std::max(values.at<double>(i), 0.0);
+
+        double retained = 0;
+        for(components = 0; components < n; ++components)
+        {
+            retained += std::max(values.at<double>(components), 0.0);
+            if(retained > retained_variance*total)
+                break;
+        }
+        components = std::min(std::max(2, components), n);
+    }
+
+    // The centred frames span at most n-1 directions. Leave out the directions without
+    // variance, but keep one component (all zero if there is no variance at all).
+    const double floor = std::max(values.at<double>(0), 0.0)*1e-12;
+    while(components > 1 && values.at<double>(components-1) <= floor)
+        components--;
+
+    // Row 0 averages the frames into the mean. Row k+1 combines them into eigenvector k,
+    // e_k = sum_i v_k(i) (x_i - mean) / sqrt(lambda_k), which has unit length.
+    cv::Mat weights = cv::Mat::zeros(components + 1, n, CV_64F);
+    for(int i = 0; i < n; ++i)
+        weights.at<double>(0, i) = 1.0 / n;
+    for(int k = 0; k < components; ++k)
+    {
+        const double lambda = values.at<double>(k);
+        if(lambda <= floor)
+            continue;
+        for(int i = 0; i < n; ++i)
+            weights.at<double>(k+1, i) = vectors.at<double>(k, i) / sqrt(lambda);
+    }
+
+    if(depth == CV_32F)
+        Project<float>(pca, weights, threads);
+    else
+        Project<double>(pca, weights, threads);
+
+    // cv::PCA reports the variance along each eigenvector
+    pca.eigenvalues.create(components, 1, depth);
+    for(int k = 0; k < components; ++k)
+    {
+        const double variance = std::max(values.at<double>(k), 0.0) / n;
+        if(depth == CV_32F)
+            pca.eigenvalues.at<float>(k) = (float)variance;
+        else
+            pca.eigenvalues.at<double>(k) = variance;
+    }
+}
+
+template<class T>
+void SnapshotPca::Project(cv::PCA& pca, const cv::Mat& weights, unsigned int threads) const
+{
+    const int n = m_count;
+    const int dims = m_frames.cols;
+    const int outputs = weights.rows;
+    const int blocks = (dims + PROJECT_BLOCK - 1) / PROJECT_BLOCK;
+
+    const int type = sizeof(T) == sizeof(float) ? CV_32F : CV_64F;
+    pca.mean.create(1, dims, type);
+    pca.eigenvectors.create(outputs - 1, dims, type);
+
+    // the mean is taken off through the sum of each row of weights
+    std::vector<double> weight_sum(outputs, 0.0);
+    for(int k = 0; k < outputs; ++k)
+        for(int i = 0; i < n; ++i)
+            weight_sum[k] += weights.at<double>(k, i);
+
+    ParallelRows(blocks, threads, [&](int block_begin, int block_end)
+    {
+        std::vector<double> sums((size_t)outputs*PROJECT_BLOCK);
+        double values[PROJECT_BLOCK];
+
+        for(int b = block_begin; b < block_end; ++b)
+        {
+            const int begin = b*PROJECT_BLOCK;
+            const int len = std::min(PROJECT_BLOCK, dims - begin);
+            std::fill(sums.begin(), sums.end(), 0.0);
+
+            for(int i = 0; i < n; ++i)
+            {
+                const unsigned char* frame = m_frames.ptr<unsigned char>(i) + begin;
+                for(int t = 0; t < len; ++t)
+                    values[t] = frame[t];
+
+                for(int k = 0; k < outputs; ++k)
+                {
+                    const double w = weights.at<double>(k, i);
+                    if(w == 0)
+                        continue;
+                    double* sum = &sums[(size_t)k*PROJECT_BLOCK];
+                    for(int t = 0; t < len; ++t)
+                        sum[t] += w*values[t];
+                }
+            }
+
+            T* mean = pca.mean.ptr<T>() + begin;
+            for(int t = 0; t < len; ++t)
+                mean[t] = (T)sums[t];
+
+            for(int k = 1; k < outputs; ++k)
+            {
+                const double* sum = &sums[(size_t)k*PROJECT_BLOCK];
+                T* e = pca.eigenvectors.ptr<T>(k-1) + begin;
+                for(int t = 0; t < len; ++t)
+                    e[t] = (T)(sum[t] - weight_sum[k]*sums[t]);
+            }
+        }
+    });
+}
+
+size_t SnapshotPca::Bytes() const
+{
+    return m_frames.total()*m_frames.elemSize() + m_gram.total()*m_gram.elemSize();
+}
@@ -0,0 +1,67 @@
+/****************************************************************************
+*
+* SnapshotPca.hpp
+*
+* Purpose: Eigenspace of a history of frames built with the snapshot method
+*          of Sirovich. The frames are kept as 8-bit values in a ring that
+*          is allocated once, and the N x N matrix of their dot products
+*          (the Gram matrix) is brought up to date as each frame arrives.
+*          Building the eigenspace then only needs the eigenvectors of that
+*          small matrix and one pass over the history to turn them into
+*          eigenvectors of the frames, rather than a double copy of every
+*          frame and the covariance computed all at once.
+*
+******************************************************************************/
+
+#ifndef BGS_SNAPSHOT_PCA_H_
+#define BGS_SNAPSHOT_PCA_H_
+
+#include <opencv2/core/core.hpp>
+
+namespace bgs
+{
+
+class SnapshotPca
+{
+public:
+    SnapshotPca();
+
+    // Allocate the ring for 'frames' frames of 'dims' 8-bit values each.
+    void Initalize(int frames, int dims);
+
+    // Copy an 8-bit frame into the ring, replacing the oldest one once it is full, and
+    // update its row of the Gram matrix. Takes O(N*D) for N frames of D values.
+    void Add(const cv::Mat& image, unsigned int threads);
+
+    // Copy of the ring and Gram matrix that later frames do not change. A plain copy shares
+    // them like cv::Mat does.
+    SnapshotPca Clone() const;
+
+    // number of frames in the ring
+    int Count() const { return m_count; }
+
+    // Store the mean, eigenvectors and eigenvalues of the frames in the ring in 'pca' the
+    // way cv::PCA computes them for data as rows. max_components > 0 keeps that many
+    // components, otherwise as many as needed to retain the given fraction of the variance.
+    // 'depth' is CV_32F or CV_64F.
+    void Compute(cv::PCA& pca, int max_components, double retained_variance, int depth,
+                 unsigned int threads) const;
+
+    size_t Bytes() const;
+
+private:
+    template<class T>
+    void Project(cv::PCA& pca, const cv::Mat& weights, unsigned int threads) const;
+
+    // one frame per row
+    cv::Mat m_frames;
+    // dot products of the frames, CV_64F; they are sums of 8-bit products so they are exact
+    cv::Mat m_gram;
+
+    int m_count;
+    int m_next;
+};
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+/****************************************************************************
+*
+* SpscQueue.hpp
+*
+* Purpose: Bounded lock-free queue between exactly one producer thread and
+*          one consumer thread, used to connect the stages of a pipeline.
+*          The items live in a ring of preallocated slots. The producer
+*          only writes the tail and the consumer only writes the head, so
+*          TryPush and TryPop never lock. A full queue makes TryPush fail,
+*          which is how a slow stage holds back the stages in front of it.
+*
+*          Push and Pop retry for a short while and then sleep on a
+*          condition variable until the other side moves its index, so a
+*          stage that waits for a slow neighbour does not burn a core. The
+*          other side only takes the lock to wake a thread that is asleep.
+*
+******************************************************************************/
+
+#ifndef BGS_SPSC_QUEUE_H_
+#define BGS_SPSC_QUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bgs
+{
+
+template<class T>
+class SpscQueue
+{
+public:
+    // Queue holding at most 'capacity' items, rounded up to a power of 2.
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while(size < capacity)
+            size *= 2;
+
+        m_slots.resize(size);
+        m_mask = size - 1;
+        m_head = 0;
+        m_tail = 0;
+        m_cached_head = 0;
+        m_cached_tail = 0;
+        m_producer.waiting = false;
+        m_consumer.waiting = false;
+    }
+
+    size_t Capacity() const { return m_slots.size(); }
+
+    // Producer: move 'item' into the queue. Returns false, leaving 'item' alone, if it is full.
+    bool TryPush(T& item)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_cached_head == m_slots.size())
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if(tail - m_cached_head == m_slots.size())
+                return false;
+        }
+
+        m_slots[tail & m_mask] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        Wake(m_consumer);
+        return true;
+    }
+
+    // Consumer: move the oldest item into 'item'. Returns false if the queue is empty.
+    bool TryPop(T& item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if(head == m_cached_tail)
+                return false;
+        }
+
+        // empty the slot, so it does not keep what the item refers to alive until it is reused
+        T& slot = m_slots[head & m_mask];
+        item = std::move(slot);
+        slot = T();
+        m_head.store(head + 1, std::memory_order_release);
+        Wake(m_producer);
+        return true;
+    }
+
+    // Blocking versions, which spin for SPIN_LIMIT tries and then sleep until the other side
+    // catches up.
+    void Push(T& item)
+    {
+        for(int spin = 0; !TryPush(item); ++spin)
+        {
+            if(spin < SPIN_LIMIT)
+                std::this_thread::yield();
+            else
+                Sleep(m_producer, [this]() { return !Full(); });
+        }
+    }
+
+    void Pop(T& item)
+    {
+        for(int spin = 0; !TryPop(item); ++spin)
+        {
+            if(spin < SPIN_LIMIT)
+                std::this_thread::yield();
+            else
+                Sleep(m_consumer, [this]() { return !Empty(); });
+        }
+    }
+
+private:
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+
+    enum { CACHE_LINE = 64 };
+
+    // tries before Push() or Pop() sleeps
+    enum { SPIN_LIMIT = 64 };
+
+    // where the producer waits for space, or the consumer for an item
+    struct Waiter
+    {
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::atomic<bool> waiting;
+    };
+
+    // only called by the producer and the consumer respectively
+    bool Full() const
+    {
+        return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire) == m_slots.size();
+    }
+
+    bool Empty() const
+    {
+        return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+    }
+
+    // Sleep until ready() holds. The flag is raised before ready() is checked and Wake() reads it
+    // after moving the index, with a full fence on both sides, so either this thread sees the new
+    // index or Wake() sees the flag and notifies, which it cannot do before the wait has begun
+    // since that needs the mutex.
+    template<class Ready>
+    static void Sleep(Waiter& waiter, const Ready& ready)
+    {
+        std::unique_lock<std::mutex> lock(waiter.mutex);
+        waiter.waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(!ready())
+            waiter.wakeup.wait(lock);
+        waiter.waiting.store(false, std::memory_order_relaxed);
+    }
+
+    static void Wake(Waiter& waiter)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!waiter.waiting.load(std::memory_order_relaxed))
+            return;
+
+        std::lock_guard<std::mutex> lock(waiter.mutex);
+        waiter.wakeup.notify_one();
+    }
+
+    std::vector<T> m_slots;
+    size_t m_mask;
+
+    // next slot to read, written by the consumer, and its copy of the tail
+    alignas(CACHE_LINE) std::atomic<size_t> m_head;
+    size_t m_cached_tail;
+
+    // next slot to write, written by the producer, and its copy of the head
+    alignas(CACHE_LINE) std::atomic<size_t> m_tail;
+    size_t m_cached_head;
+
+    alignas(CACHE_LINE) Waiter m_producer;
+    Waiter m_consumer;
+};
+
+}
+
+#endif
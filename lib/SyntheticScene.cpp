@@ -0,0 +1,334 @@
+#include "SyntheticScene.hpp"
+#include "Bgs.hpp"
+#include "ThreadPool.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace bgs;
+
+namespace
+{
+
+const float PI = 3.14159265f;
+
+// streams of the seed, so the parts of the scene do not share random numbers
+enum Stream
+{
+    BACKGROUND_STREAM = 1,
+    TEXTURE_STREAM,
+    SPRITE_STREAM,
+    NOISE_STREAM
+};
+
+// Counter based hash, so any value can be computed without the ones before it.
+inline uint32_t Hash(uint32_t a, uint32_t b, uint32_t c)
+{
+    uint32_t h = a*0x9e3779b1u ^ (b + 0x7f4a7c15u)*0x85ebca77u ^ (c + 0x165667b1u)*0xc2b2ae3du;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// uniform in [0, 1)
+inline float Uniform(uint32_t a, uint32_t b, uint32_t c)
+{
+    return (Hash(a, b, c) >> 8)*(1.0f/16777216.0f);
+}
+
+// Value noise in [0, 1): random values on a grid of 'cell' pixels, smoothly interpolated.
+float Smooth(int x, int y, int cell, uint32_t seed)
+{
+    const int gx = x / cell;
+    const int gy = y / cell;
+    float fx = (float)(x - gx*cell) / cell;
+    float fy = (float)(y - gy*cell) / cell;
+    fx = fx*fx*(3 - 2*fx);
+    fy = fy*fy*(3 - 2*fy);
+
+    const float v00 = Uniform(seed, gx, gy);
+    const float v10 = Uniform(seed, gx+1, gy);
+    const float v01 = Uniform(seed, gx, gy+1);
+    const float v11 = Uniform(seed, gx+1, gy+1);
+    const float top = v00 + fx*(v10 - v00);
+    const float bottom = v01 + fx*(v11 - v01);
+    return top + fy*(bottom - top);
+}
+
+// position in [low, high] of a point moving from 'value' that bounces between them
+float Reflect(float value, float low, float high)
+{
+    const float range = high - low;
+    if(range <= 0)
+        return (low + high)/2;
+
+    float u = fmodf(value - low, 2*range);
+    if(u < 0)
+        u += 2*range;
+    if(u > range)
+        u = 2*range - u;
+    return low + u;
+}
+
+inline unsigned char Saturate(float v)
+{
+    return (unsigned char)std::min(std::max(v + 0.5f, 0.0f), 255.0f);
+}
+
+}
+
+SyntheticScene::SyntheticScene(const SyntheticSceneParams& p)
+{
+    m_params = p;
+    m_position = 0;
+
+    if(m_params.Width() <= 0 || m_params.Height() <= 0)
+        CV_Error( CV_StsBadArg, "SyntheticScene needs a frame size" );
+    if(m_params.Channels() != 1 && m_params.Channels() != 3)
+        CV_Error( CV_StsUnsupportedFormat, "SyntheticScene renders 1-channel or 3-channel images" );
+    if(m_params.TextureRegions() < 0 || m_params.TextureRegions() > 255 || m_params.TextureModes() < 1 ||
+       m_params.TexturePeriod() < 1 || m_params.DriftPeriod() < 1 || m_params.Sprites() < 0)
+        CV_Error( CV_StsOutOfRange, "SyntheticScene parameter out of range" );
+
+    CreateBackground();
+    CreateTexture();
+    CreateSprites();
+}
+
+// Flat colour with a large gradient, blotches and a fine static texture.
+void SyntheticScene::CreateBackground()
+{
+    const int width = m_params.Width();
+    const int height = m_params.Height();
+    const int channels = m_params.Channels();
+    const uint32_t seed = Hash(m_params.Seed(), BACKGROUND_STREAM, 0);
+
+    float base[3];
+    for(int ch = 0; ch < channels; ++ch)
+        base[ch] = 60 + 130*Uniform(seed, 0, ch);
+
+    const int large = std::max(std::max(width, height) / 3, 1);
+    const int blotch = 24;
+
+    m_background.create(height, width, CV_8UC(channels));
+    ParallelRows(height, m_params.Threads(), [&](int row_begin, int row_end)
+    {
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            unsigned char* p = m_background.ptr<unsigned char>(r);
+            for(int c = 0; c < width; ++c)
+            {
+                const float light = 70*(Smooth(c, r, large, seed + 1) - 0.5f);
+                for(int ch = 0; ch < channels; ++ch)
+                {
+                    float v = base[ch] + light + 25*(Smooth(c, r, blotch, seed + 2 + ch) - 0.5f);
+                    v += (float)(Hash(seed, r, c*channels + ch) & 15) - 7.5f;
+                    p[c*channels + ch] = Saturate(v);
+                }
+            }
+        }
+    });
+}
+
+// Elliptical regions whose pixels cycle through the colours of their modes. The phase of the
+// cycle changes smoothly over a region, so the modes sweep across it in waves.
+void SyntheticScene::CreateTexture()
+{
+    const int width = m_params.Width();
+    const int height = m_params.Height();
+    const int channels = m_params.Channels();
+    const int regions = m_params.TextureRegions();
+    const int modes = m_params.TextureModes();
+    const uint32_t seed = Hash(m_params.Seed(), TEXTURE_STREAM, 0);
+
+    struct Ellipse { float x, y, radius_x, radius_y; };
+    std::vector<Ellipse> ellipses(regions);
+    m_texture_colours.resize(regions*modes*channels);
+    for(int i = 0; i < regions; ++i)
+    {
+        ellipses[i].x = width*Uniform(seed, i, 0);
+        ellipses[i].y = height*Uniform(seed, i, 1);
+        ellipses[i].radius_x = width*(0.1f + 0.15f*Uniform(seed, i, 2));
+        ellipses[i].radius_y = height*(0.1f + 0.15f*Uniform(seed, i, 3));
+
+        // the modes are spread evenly between a dark and a light leaf colour
+        const float dark[3] = { 20 + 40*Uniform(seed, i, 4), 50 + 50*Uniform(seed, i, 5), 20 + 40*Uniform(seed, i, 6) };
+        const float light[3] = { 90 + 60*Uniform(seed, i, 7), 160 + 80*Uniform(seed, i, 8), 80 + 60*Uniform(seed, i, 9) };
+        for(int k = 0; k < modes; ++k)
+        {
+            const float t = (k + 0.5f + 0.4f*(Uniform(seed, i, 10 + k) - 0.5f)) / modes;
+            for(int ch = 0; ch < channels; ++ch)
+            {
+                // a grey scene takes the green channel
+                const int from = (channels == 1) ? 1 : ch;
+                m_texture_colours[(i*modes + k)*channels + ch] = Saturate(dark[from] + t*(light[from] - dark[from]));
+            }
+        }
+    }
+
+    const int wave = std::max(height / 20, 8);
+
+    m_region.create(height, width, CV_8U);
+    m_phase.create(height, width, CV_8U);
+    ParallelRows(height, m_params.Threads(), [&](int row_begin, int row_end)
+    {
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            unsigned char* region = m_region.ptr<unsigned char>(r);
+            unsigned char* phase = m_phase.ptr<unsigned char>(r);
+            memset(region, 0, width);
+            memset(phase, 0, width);
+
+            for(int i = 0; i < regions; ++i)
+            {
+                const Ellipse& e = ellipses[i];
+                const float dy = (r - e.y) / e.radius_y;
+                if(dy <= -1 || dy >= 1)
+                    continue;
+
+                const float half = e.radius_x*sqrtf(1 - dy*dy);
+                const int begin = std::max((int)ceilf(e.x - half), 0);
+                const int end = std::min((int)floorf(e.x + half), width - 1);
+                for(int c = begin; c <= end; ++c)
+                {
+                    region[c] = (unsigned char)(i + 1);
+                    phase[c] = (unsigned char)((int)(512*Smooth(c, r, wave, seed + 1 + i)) + (Hash(seed, r, c) & 15));
+                }
+            }
+        }
+    });
+}
+
+void SyntheticScene::CreateSprites()
+{
+    const int width = m_params.Width();
+    const int height = m_params.Height();
+    const uint32_t seed = Hash(m_params.Seed(), SPRITE_STREAM, 0);
+
+    m_sprites.resize(m_params.Sprites());
+    for(int i = 0; i < m_params.Sprites(); ++i)
+    {
+        Sprite& s = m_sprites[i];
+        s.radius_y = std::max(0.5f*height*m_params.SpriteSize()*(0.6f + 0.8f*Uniform(seed, i, 0)), 1.0f);
+        s.radius_x = std::max(s.radius_y*(0.5f + Uniform(seed, i, 1)), 1.0f);
+        s.x = width*Uniform(seed, i, 2);
+        s.y = height*Uniform(seed, i, 3);
+
+        const float angle = 2*PI*Uniform(seed, i, 4);
+        const float speed = width*m_params.SpriteSpeed()*(0.5f + Uniform(seed, i, 5));
+        s.vx = speed*cosf(angle);
+        s.vy = speed*sinf(angle);
+
+        s.seed = Hash(seed, i, 6);
+        for(int ch = 0; ch < 3; ++ch)
+            s.colour[ch] = (unsigned char)(255*Uniform(seed, i, 7 + ch));
+    }
+}
+
+bool SyntheticScene::Read(cv::Mat& image, cv::Mat& foreground_mask)
+{
+    if(m_params.Frames() > 0 && m_position >= m_params.Frames())
+        return false;
+
+    Render(m_position++, image, foreground_mask);
+    return true;
+}
+
+void SyntheticScene::Render(int frame, cv::Mat& image, cv::Mat& foreground_mask)
+{
+    const int width = m_params.Width();
+    const int height = m_params.Height();
+    const int channels = m_params.Channels();
+    const int modes = m_params.TextureModes();
+    const int64_t period = m_params.TexturePeriod();
+
+    if(frame < 0)
+        CV_Error( CV_StsOutOfRange, "SyntheticScene frames start at 0" );
+
+    const float gain = 1 + m_params.Drift()*sinf(2*PI*(frame % m_params.DriftPeriod()) / m_params.DriftPeriod());
+    // the sum of 4 uniform bytes has a standard deviation of 147.8
+    const float noise = m_params.Noise() / 147.8f;
+    const uint32_t noise_seed = Hash(m_params.Seed(), NOISE_STREAM, frame);
+
+    // sprite positions in this frame
+    struct Placed { float x, y; int left, top; };
+    std::vector<Placed> placed(m_sprites.size());
+    for(size_t i = 0; i < m_sprites.size(); ++i)
+    {
+        const Sprite& s = m_sprites[i];
+        placed[i].x = Reflect(s.x + s.vx*frame, s.radius_x, width - s.radius_x);
+        placed[i].y = Reflect(s.y + s.vy*frame, s.radius_y, height - s.radius_y);
+        placed[i].left = (int)floorf(placed[i].x);
+        placed[i].top = (int)floorf(placed[i].y);
+    }
+
+    image.create(height, width, CV_8UC(channels));
+    foreground_mask.create(height, width, CV_8U);
+
+    ParallelRows(height, m_params.Threads(), [&](int row_begin, int row_end)
+    {
+        std::vector<float> row(width*channels);
+        for(int r = row_begin; r < row_end; ++r)
+        {
+            const unsigned char* background = m_background.ptr<unsigned char>(r);
+            const unsigned char* region = m_region.ptr<unsigned char>(r);
+            const unsigned char* phase = m_phase.ptr<unsigned char>(r);
+            unsigned char* out = image.ptr<unsigned char>(r);
+            unsigned char* mask = foreground_mask.ptr<unsigned char>(r);
+
+            for(int c = 0; c < width; ++c)
+            {
+                const unsigned char* b = background + c*channels;
+                float* v = &row[c*channels];
+                if(region[c])
+                {
+                    // position in the cycle, in cycles, is frame/period + phase/256
+                    const int k = (int)((((int64_t)frame*256 + phase[c]*period)*modes / (256*period)) % modes);
+                    const unsigned char* colour = &m_texture_colours[((region[c] - 1)*modes + k)*channels];
+                    for(int ch = 0; ch < channels; ++ch)
+                        v[ch] = 0.5f*(b[ch] + colour[ch]);
+                }
+                else
+                {
+                    for(int ch = 0; ch < channels; ++ch)
+                        v[ch] = b[ch];
+                }
+            }
+
+            memset(mask, Bgs::BACKGROUND, width);
+            for(size_t i = 0; i < m_sprites.size(); ++i)
+            {
+                const Sprite& s = m_sprites[i];
+                const float dy = (r - placed[i].y) / s.radius_y;
+                if(dy <= -1 || dy >= 1)
+                    continue;
+
+                const float half = s.radius_x*sqrtf(1 - dy*dy);
+                const int begin = std::max((int)ceilf(placed[i].x - half), 0);
+                const int end = std::min((int)floorf(placed[i].x + half), width - 1);
+                for(int c = begin; c <= end; ++c)
+                {
+                    // texture fixed to the sprite, so it moves with it
+                    const uint32_t h = Hash(s.seed, c - placed[i].left, r - placed[i].top);
+                    const float detail = (float)(h & 31) - 15.5f;
+                    for(int ch = 0; ch < channels; ++ch)
+                        row[c*channels + ch] = s.colour[channels == 1 ? 1 : ch] + detail;
+                    mask[c] = Bgs::FOREGROUND;
+                }
+            }
+
+            const uint32_t row_seed = Hash(noise_seed, r, 0);
+            for(int i = 0; i < width*channels; ++i)
+            {
+                const uint32_t h = Hash(row_seed, i, 0);
+                const float n = (float)((int)(h & 0xff) + (int)((h >> 8) & 0xff) + (int)((h >> 16) & 0xff) + (int)(h >> 24) - 510);
+                out[i] = Saturate(row[i]*gain + n*noise);
+            }
+        }
+    });
+}
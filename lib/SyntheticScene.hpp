@@ -0,0 +1,157 @@
+/****************************************************************************
+*
+* SyntheticScene.hpp
+*
+* Purpose: Procedural video source for benchmarks and accuracy tests. It
+*          renders a seeded static background with
+*
+*          - sensor noise, roughly Gaussian and new in every frame
+*          - a slow sinusoidal drift of the illumination
+*          - regions of dynamic texture, such as waving foliage, where each
+*            pixel cycles through TextureModes() colours, so the background
+*            is multimodal there
+*          - moving foreground sprites that bounce off the frame edges
+*
+*          together with the ground truth mask of the sprites. Every frame
+*          depends only on the parameters and its index, so the same seed
+*          gives the same video on every machine and frames can be rendered
+*          in any order.
+*
+******************************************************************************/
+
+#ifndef BGS_SYNTHETIC_SCENE_H_
+#define BGS_SYNTHETIC_SCENE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace bgs
+{
+
+class SyntheticSceneParams
+{
+public:
+    SyntheticSceneParams()
+    {
+        m_width = 640;
+        m_height = 480;
+        m_channels = 3;
+        m_frames = 0;
+        m_seed = 1;
+        m_noise = 3.0f;
+        m_drift = 0.1f;
+        m_drift_period = 500;
+        m_texture_regions = 2;
+        m_texture_modes = 3;
+        m_texture_period = 40;
+        m_sprites = 3;
+        m_sprite_size = 0.2f;
+        m_sprite_speed = 0.005f;
+        m_threads = 0;
+    }
+
+    int &Width() { return m_width; }
+    int &Height() { return m_height; }
+    // 1 or 3
+    int &Channels() { return m_channels; }
+
+    // Number of frames Read() returns, 0 for no end.
+    int &Frames() { return m_frames; }
+
+    uint32_t &Seed() { return m_seed; }
+
+    // Standard deviation of the sensor noise in grey levels.
+    float &Noise() { return m_noise; }
+
+    // The illumination is scaled by 1 + Drift()*sin(2*pi*frame/DriftPeriod()).
+    float &Drift() { return m_drift; }
+    int &DriftPeriod() { return m_drift_period; }
+
+    // Number of dynamic texture regions, the colours each pixel in them cycles through and the
+    // frames a cycle takes.
+    int &TextureRegions() { return m_texture_regions; }
+    int &TextureModes() { return m_texture_modes; }
+    int &TexturePeriod() { return m_texture_period; }
+
+    // Number of sprites, their mean height as a fraction of the frame height and their mean
+    // speed as a fraction of the frame width per frame.
+    int &Sprites() { return m_sprites; }
+    float &SpriteSize() { return m_sprite_size; }
+    float &SpriteSpeed() { return m_sprite_speed; }
+
+    // Number of threads Read() and Render() may use, 0 for all cores and 1 to run serially.
+    unsigned int &Threads() { return m_threads; }
+
+private:
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_frames;
+    uint32_t m_seed;
+    float m_noise;
+    float m_drift;
+    int m_drift_period;
+    int m_texture_regions;
+    int m_texture_modes;
+    int m_texture_period;
+    int m_sprites;
+    float m_sprite_size;
+    float m_sprite_speed;
+    unsigned int m_threads;
+};
+
+class SyntheticScene
+{
+public:
+    SyntheticScene(const SyntheticSceneParams& p);
+
+    // Render the next frame and its ground truth mask, 255 where a sprite is. Returns false once
+    // Frames() frames have been read.
+    bool Read(cv::Mat& image, cv::Mat& foreground_mask);
+
+    // Render any frame without changing the position of Read().
+    void Render(int frame, cv::Mat& image, cv::Mat& foreground_mask);
+
+    // Index of the frame Read() returns next.
+    int &Position() { return m_position; }
+
+    // The static background, without noise, drift or dynamic texture.
+    const cv::Mat& Background() const { return m_background; }
+
+private:
+    struct Sprite
+    {
+        float x;              // centre in frame 0
+        float y;
+        float vx;             // pixels per frame
+        float vy;
+        float radius_x;
+        float radius_y;
+        uint32_t seed;
+        unsigned char colour[3];
+    };
+
+    void CreateBackground();
+    void CreateTexture();
+    void CreateSprites();
+
+    SyntheticSceneParams m_params;
+    int m_position;
+
+    // static background, CV_8UC(channels)
+    cv::Mat m_background;
+    // texture region of each pixel, 0 for none, and the phase of its cycle in 1/256ths
+    cv::Mat m_region;
+    cv::Mat m_phase;
+    // colours of the modes of each region, TextureModes()*channels values per region
+    std::vector<unsigned char> m_texture_colours;
+
+    std::vector<Sprite> m_sprites;
+};
+
+}
+
+#endif
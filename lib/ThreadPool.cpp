@@ -0,0 +1,198 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+using namespace bgs;
+
+namespace
+{
+    // index of the pool worker running on this thread, -1 for all other threads
+    thread_local int t_worker_id = -1;
+    thread_local const void* t_worker_pool = 0;
+}
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    if(threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if(threads == 0)
+        threads = 1;
+
+    m_queued = 0;
+    m_stop = false;
+
+    // the thread calling ParallelFor() does its share of the work, so one worker less is needed
+    for(unsigned int i = 0; i+1 < threads; ++i)
+        m_queues.push_back(new Queue());
+
+    for(unsigned int i = 0; i+1 < threads; ++i)
+        m_workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for(unsigned int i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+
+    for(unsigned int i = 0; i < m_queues.size(); ++i)
+        delete m_queues[i];
+}
+
+ThreadPool& ThreadPool::Instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int grain, const RangeBody& body)
+{
+    if(end <= begin)
+        return;
+
+    if(grain < 1)
+        grain = 1;
+
+    // nothing to share, run in place
+    if(m_workers.empty() || end - begin <= grain)
+    {
+        body(begin, end);
+        return;
+    }
+
+    Batch batch;
+    batch.pending = (end - begin + grain - 1) / grain;
+
+    // deal the ranges out round-robin, starting with our own deque when called from a worker
+    int self = (t_worker_pool == this) ? t_worker_id : -1;
+    unsigned int q = self >= 0 ? self : 0;
+    for(int b = begin; b < end; b += grain)
+    {
+        Task task;
+        task.body = &body;
+        task.begin = b;
+        task.end = std::min(b + grain, end);
+        task.batch = &batch;
+
+        {
+            std::lock_guard<std::mutex> lock(m_queues[q]->mutex);
+            m_queues[q]->tasks.push_back(task);
+        }
+        m_queued++;
+        q = (q + 1) % m_queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+    }
+    m_wake.notify_all();
+
+    // help until our batch is complete
+    Task task;
+    while(batch.pending > 0)
+    {
+        if(Pop(self, task))
+        {
+            Execute(task);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(batch.mutex);
+            batch.done.wait(lock, [&batch] { return batch.pending == 0; });
+        }
+    }
+
+    // wait for the thread that finished the last range to let go of the batch
+    {
+        std::lock_guard<std::mutex> lock(batch.mutex);
+    }
+
+    if(batch.error)
+        std::rethrow_exception(batch.error);
+}
+
+void ThreadPool::WorkerLoop(unsigned int id)
+{
+    t_worker_id = id;
+    t_worker_pool = this;
+
+    Task task;
+    for(;;)
+    {
+        if(Pop(id, task))
+        {
+            Execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_wake_mutex);
+        m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if(m_stop)
+            return;
+    }
+}
+
+bool ThreadPool::Pop(int id, Task& task)
+{
+    if(m_queued <= 0)
+        return false;
+
+    // own work first, oldest range first
+    if(id >= 0)
+    {
+        Queue* queue = m_queues[id];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if(!queue->tasks.empty())
+        {
+            task = queue->tasks.front();
+            queue->tasks.pop_front();
+            m_queued--;
+            return true;
+        }
+    }
+
+    // steal from the back of another worker's deque
+    unsigned int n = m_queues.size();
+    unsigned int start = id >= 0 ? id + 1 : 0;
+    for(unsigned int i = 0; i < n; ++i)
+    {
+        Queue* queue = m_queues[(start + i) % n];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if(!queue->tasks.empty())
+        {
+            task = queue->tasks.back();
+            queue->tasks.pop_back();
+            m_queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::Execute(const Task& task)
+{
+    Batch* batch = task.batch;
+
+    try
+    {
+        (*task.body)(task.begin, task.end);
+    }
+    catch(...)
+    {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if(!batch->error)
+            batch->error = std::current_exception();
+    }
+
+    // the batch lives on the stack of the thread waiting for it, so it must not be touched
+    // once that thread can see it finished; decrement and notify under its lock
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    if(--batch->pending == 0)
+        batch->done.notify_all();
+}
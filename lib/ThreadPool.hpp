@@ -0,0 +1,113 @@
+/****************************************************************************
+*
+* ThreadPool.hpp
+*
+* Purpose: Persistent pool of worker threads shared by all BGS algorithms.
+*          Work is split into ranges which are queued on per-worker deques.
+*          A worker takes work from the front of its own deque and steals
+*          from the back of the others once it runs dry. A thread waiting
+*          for its work to finish runs queued ranges as well, so nested
+*          parallel loops cannot deadlock the pool.
+*
+******************************************************************************/
+
+#ifndef BGS_THREAD_POOL_H_
+#define BGS_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bgs
+{
+
+class ThreadPool
+{
+public:
+    typedef std::function<void(int, int)> RangeBody;
+
+    // Create a pool that runs on 'threads' threads including the calling thread.
+    // 0 uses one thread per hardware core.
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    // Pool shared by all BGS instances in the process.
+    static ThreadPool& Instance();
+
+    // Number of threads work is spread over, including the calling thread.
+    unsigned int Threads() const { return (unsigned int)m_workers.size() + 1; }
+
+    // Split [begin, end) into ranges of at most 'grain' elements and call body(range_begin, range_end)
+    // for each of them. Returns when all ranges have been processed. If a range throws, the first
+    // exception is rethrown here once the remaining ranges are done.
+    void ParallelFor(int begin, int end, int grain, const RangeBody& body);
+
+private:
+    struct Batch
+    {
+        std::atomic<int> pending;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+
+    struct Task
+    {
+        const RangeBody* body;
+        int begin;
+        int end;
+        Batch* batch;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void WorkerLoop(unsigned int id);
+    bool Pop(int id, Task& task);
+    void Execute(const Task& task);
+
+    std::vector<std::thread> m_workers;
+    std::vector<Queue*> m_queues;
+
+    // number of queued tasks and the condition idle workers sleep on
+    std::atomic<int> m_queued;
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake;
+    bool m_stop;
+};
+
+// Call body(row_begin, row_end) for bands of rows covering [0, rows) on the shared pool. Bands
+// are independent, so the result is the same as running body(0, rows) on one thread. threads == 1
+// runs the body serially on the calling thread, 0 uses the whole pool.
+template<class Body>
+void ParallelRows(int rows, unsigned int threads, const Body& body)
+{
+    ThreadPool& pool = ThreadPool::Instance();
+    if(threads == 1 || pool.Threads() == 1)
+    {
+        body(0, rows);
+        return;
+    }
+
+    // a few bands per thread so threads that finish early can steal the remainder; with
+    // an explicit thread count there is one band per thread so no more than that run at once
+    int bands = (threads == 0) ? 4*pool.Threads() : threads;
+    int band = std::max(1, (rows + bands - 1) / bands);
+    pool.ParallelFor(0, rows, band, body);
+}
+
+}
+
+#endif
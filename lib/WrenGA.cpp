@@ -1,4 +1,5 @@
 #include "WrenGA.hpp"
+#include "Simd.hpp"
 
 using namespace bgs;
 
@@ -27,29 +28,29 @@ WrenGA::~WrenGA()
 
 void WrenGA::Initalize(const cv::Mat& image)
 {
-    if(image.type() != CV_8UC3)
-        CV_Error( CV_StsUnsupportedFormat, "Only 3-channel 8-bit images are supported in libBGS" );
+    if(image.type() != CV_8UC1 && image.type() != CV_8UC3)
+        CV_Error( CV_StsUnsupportedFormat, "Only 1-channel or 3-channel 8-bit images are supported in libBGS" );
 
-    // GMM for each pixel
-    m_gaussian.resize(m_params.Size());
+    m_params.SetFrameSize(image.cols, image.rows);
+    m_params.Channels() = image.channels();
 
-    int pos = 0;
+    // Gaussian for each pixel
+    const int channels = m_params.Channels();
+    m_mean.create(m_params.Height()*channels, m_params.Width(), CV_32F);
+    m_var = cv::Mat(m_params.Height(), m_params.Width(), CV_32F, cv::Scalar(m_variance));
     for(unsigned int r = 0; r < m_params.Height(); ++r)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        const unsigned char* pixels = image.ptr<unsigned char>(r);
+        for(int ch = 0; ch < channels; ++ch)
         {
-            for(int ch = 0; ch < 3; ++ch)
-            {
-                m_gaussian[pos].mu[ch] = image.at<cv::Vec3b>(r,c)[ch];
-                m_gaussian[pos].var[ch] = m_variance;
-            }
-
-            pos++;
+            float* mean = m_mean.ptr<float>(r*channels + ch);
+            for(unsigned int c = 0; c < m_params.Width(); ++c)
+                mean[c] = pixels[c*channels + ch];
         }
     }
 
     // background
-    m_background = cv::Mat(m_params.Height(), m_params.Width(), CV_8UC3);
+    m_background = image.clone();
 }
 
 void WrenGA::Save(std::string file)
@@ -62,6 +63,59 @@ void WrenGA::Load(std::string file)
 
 }
 
+namespace
+{
+
+// Squared distance between the pixels and the means over the channels, compared against
+// each threshold times the variance.
+template<class V, int CHANNELS>
+void SubtractPixels(const unsigned char* pixels, const float* const* mean, const float* var, int c,
+                    unsigned char* low, unsigned char* high, const V& low_threshold, const V& high_threshold)
+{
+    V dist = V::zero();
+    for(int ch = 0; ch < CHANNELS; ++ch)
+    {
+        V delta = V::load(mean[ch] + c) - V::load_u8(pixels + ch, CHANNELS);
+        dist = dist + delta*delta;
+    }
+
+    V v = V::load(var + c);
+    v_store_mask_u8(low, dist > low_threshold*v, Bgs::FOREGROUND, Bgs::BACKGROUND);
+    v_store_mask_u8(high, dist > high_threshold*v, Bgs::FOREGROUND, Bgs::BACKGROUND);
+}
+
+// Move the means and the variance of the updated pixels towards the new values and round
+// the background from the new means in the same pass.
+template<class V, int CHANNELS>
+void UpdatePixels(const unsigned char* pixels, float* const* mean, float* var, int c, const unsigned char* mask,
+                  unsigned char* background, const V& alpha, const V& min_var, const V& max_var, bool learning)
+{
+    typedef typename V::Mask M;
+
+    M update = learning ? ~M::none() : (V::load_u8(mask) == V::set1(Bgs::BACKGROUND));
+    if(!update.any())
+        return;
+
+    const V half = V::set1(0.5f);
+    V dist = V::zero();
+    for(int ch = 0; ch < CHANNELS; ++ch)
+    {
+        V mu = V::load(mean[ch] + c);
+        V delta = mu - V::load_u8(pixels + ch, CHANNELS);
+        dist = dist + delta*delta;
+
+        mu = v_select(update, mu - alpha*delta, mu);
+        V::store(mean[ch] + c, mu);
+        V::store_u8(background + ch, mu + half, CHANNELS);
+    }
+
+    V v = V::load(var + c);
+    V sigmanew = v_min(v_max(v + alpha*(dist - v), min_var), max_var);
+    V::store(var + c, v_select(update, sigmanew, v));
+}
+
+}
+
 void WrenGA::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
     if(m_frame_num == 0)
@@ -73,81 +127,90 @@ void WrenGA::Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat
     if(high_threshold_mask.empty())
         high_threshold_mask.create(m_params.Height(), m_params.Width(), CV_8U);
 
-    unsigned char low_threshold, high_threshold;
-
-    // update each pixel of the image
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    // compare each pixel of the image with its Gaussian, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        for(int r = row_begin; r < row_end; ++r)
         {
-            SubtractPixel(r, c, image.at<cv::Vec3b>(r,c), low_threshold, high_threshold);
-            low_threshold_mask.at<unsigned char>(r,c) = low_threshold;
-            high_threshold_mask.at<unsigned char>(r,c) = high_threshold;
+            if(m_params.Channels() == 3)
+                SubtractRow<3>(r, image, low_threshold_mask, high_threshold_mask);
+            else
+                SubtractRow<1>(r, image, low_threshold_mask, high_threshold_mask);
         }
-    }
+    });
 
     m_frame_num++;
 }
 
 void WrenGA::Update(const cv::Mat& image,  const cv::Mat& update_mask)
 {
-    int pos = 0;
+    // perform conditional updating only if we are passed the learning phase
+    const bool learning = m_frame_num < m_params.LearningFrames();
 
-    for(unsigned int r = 0; r < m_params.Height(); ++r)
+    // update background model, a band of rows at a time
+    ParallelRows(m_params.Height(), m_params.Threads(), [&](int row_begin, int row_end)
     {
-        for(unsigned int c = 0; c < m_params.Width(); ++c)
+        for(int r = row_begin; r < row_end; ++r)
         {
-            // perform conditional updating only if we are passed the learning phase
-            if(update_mask.at<unsigned char>(r,c) == BACKGROUND || m_frame_num < m_params.LearningFrames())
-            {
-                float dR = m_gaussian[pos].mu[0] - image.at<cv::Vec3b>(r,c)[0];
-                float dG = m_gaussian[pos].mu[1] - image.at<cv::Vec3b>(r,c)[1];
-                float dB = m_gaussian[pos].mu[2] - image.at<cv::Vec3b>(r,c)[2];
-
-                float dist = (dR*dR + dG*dG + dB*dB);
-
-                m_gaussian[pos].mu[0] -= m_params.Alpha()*(dR);
-                m_gaussian[pos].mu[1] -= m_params.Alpha()*(dG);
-                m_gaussian[pos].mu[2] -= m_params.Alpha()*(dB);
-
-                float sigmanew = m_gaussian[pos].var[0] + m_params.Alpha()*(dist-m_gaussian[pos].var[0]);
-                m_gaussian[pos].var[0] = sigmanew < 4 ? 4 : sigmanew > 5*m_variance ? 5*m_variance : sigmanew;
-
-                m_background.at<cv::Vec3b>(r,c)[0] = (unsigned char)(m_gaussian[pos].mu[0] + 0.5);
-                m_background.at<cv::Vec3b>(r,c)[1] = (unsigned char)(m_gaussian[pos].mu[1] + 0.5);
-                m_background.at<cv::Vec3b>(r,c)[2] = (unsigned char)(m_gaussian[pos].mu[2] + 0.5);
-            }
-
-            pos++;
+            if(m_params.Channels() == 3)
+                UpdateRow<3>(r, image, update_mask, learning);
+            else
+                UpdateRow<1>(r, image, update_mask, learning);
         }
-    }
+    });
 }
 
-void WrenGA::SubtractPixel(int r, int c, const cv::Vec3b& pixel, unsigned char& low_threshold, unsigned char& high_threshold)
+template<int CHANNELS>
+void WrenGA::SubtractRow(int r, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask)
 {
-    unsigned int pos = r*m_params.Width()+c;
-
-    // calculate distance between model and pixel
-    float mu[3];
-    float var[1];
-    float delta[3];
-    float dist = 0;
-    for(int ch = 0; ch < 3; ++ch)
-    {
-        mu[ch] = m_gaussian[pos].mu[ch];
-        var[0] = m_gaussian[pos].var[0];
-        delta[ch] = mu[ch] - pixel[ch];
-        dist += delta[ch]*delta[ch];
-    }
-
-    // calculate the squared distance and see if pixel fits the B/G model
-    low_threshold = BACKGROUND;
-    high_threshold = BACKGROUND;
-
-    if(dist > m_params.LowThreshold()*var[0])
-        low_threshold = FOREGROUND;
-    if(dist > m_params.HighThreshold()*var[0])
-        high_threshold = FOREGROUND;
+    typedef simd::VFloat V;
+    typedef simd::VFloat1 V1;
+
+    const V low = V::set1(m_params.LowThreshold()), high = V::set1(m_params.HighThreshold());
+    const V1 low1 = V1::set1(m_params.LowThreshold()), high1 = V1::set1(m_params.HighThreshold());
+
+    const float* mean[CHANNELS];
+    for(int ch = 0; ch < CHANNELS; ++ch)
+        mean[ch] = m_mean.ptr<float>(r*CHANNELS + ch);
+    const float* var = m_var.ptr<float>(r);
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    unsigned char* lowMask = low_threshold_mask.ptr<unsigned char>(r);
+    unsigned char* highMask = high_threshold_mask.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        SubtractPixels<V, CHANNELS>(pixels + CHANNELS*c, mean, var, c, lowMask + c, highMask + c, low, high);
+    for(; c < width; ++c)
+        SubtractPixels<V1, CHANNELS>(pixels + CHANNELS*c, mean, var, c, lowMask + c, highMask + c, low1, high1);
 }
 
-
+template<int CHANNELS>
+void WrenGA::UpdateRow(int r, const cv::Mat& image, const cv::Mat& update_mask, bool learning)
+{
+    typedef simd::VFloat V;
+    typedef simd::VFloat1 V1;
+
+    // the variance is kept between 4 and 5 times the initial variance
+    const V alpha = V::set1(m_params.Alpha()), minVar = V::set1(4.0f), maxVar = V::set1(5*m_variance);
+    const V1 alpha1 = V1::set1(m_params.Alpha()), minVar1 = V1::set1(4.0f), maxVar1 = V1::set1(5*m_variance);
+
+    float* mean[CHANNELS];
+    for(int ch = 0; ch < CHANNELS; ++ch)
+        mean[ch] = m_mean.ptr<float>(r*CHANNELS + ch);
+    float* var = m_var.ptr<float>(r);
+
+    const int width = m_params.Width();
+    const unsigned char* pixels = image.ptr<unsigned char>(r);
+    const unsigned char* mask = update_mask.ptr<unsigned char>(r);
+    unsigned char* background = m_background.ptr<unsigned char>(r);
+
+    int c = 0;
+    for(; c + V::WIDTH <= width; c += V::WIDTH)
+        UpdatePixels<V, CHANNELS>(pixels + CHANNELS*c, mean, var, c, mask + c, background + CHANNELS*c,
+                                  alpha, minVar, maxVar, learning);
+    for(; c < width; ++c)
+        UpdatePixels<V1, CHANNELS>(pixels + CHANNELS*c, mean, var, c, mask + c, background + CHANNELS*c,
+                                   alpha1, minVar1, maxVar1, learning);
+}
@@ -33,7 +33,7 @@ public:
         m_alpha = 0.005f;
         m_learning_frames = 30;
         m_low_threshold = 3.5f*3.5f;
-        m_high_threshold = 2*m_high_threshold;    // Note: high threshold is used by post-processing
+        m_high_threshold = 2*m_low_threshold;    // Note: high threshold is used by post-processing
     }
 
     float &Alpha() { return m_alpha; }
@@ -49,13 +49,6 @@ private:
 
 class WrenGA : public Bgs
 {
-private:
-    struct GAUSSIAN
-    {
-        float mu[3];
-        float var[3];
-    };
-
 public:
     WrenGA();
     WrenGA(const BgsParams& p);
@@ -77,15 +70,22 @@ public:
 
 private:
     void Initalize(const cv::Mat& image);
-    void SubtractPixel(int r, int c, const cv::Vec3b& pixel, unsigned char& lowThreshold, unsigned char& highThreshold);
+
+    template<int CHANNELS>
+    void SubtractRow(int r, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
+
+    template<int CHANNELS>
+    void UpdateRow(int r, const cv::Mat& image, const cv::Mat& update_mask, bool learning);
 
     WrenParams m_params;
 
     // Initial variance for the newly generated components.
     float m_variance;
 
-    // dynamic array for the mixture of Gaussians
-    std::vector<GAUSSIAN> m_gaussian;
+    // Gaussian of each pixel: a mean plane per channel, with row r*Channels()+ch holding
+    // channel ch of image row r, and one variance plane shared by the channels
+    cv::Mat m_mean;
+    cv::Mat m_var;
 
     cv::Mat m_background;
 };
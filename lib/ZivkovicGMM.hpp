@@ -20,6 +20,8 @@
 #define ZIVKOVIC_GMM_H
 
 #include "Bgs.hpp"
+#include "GmmEngine.hpp"
+#include "FixedGmmEngine.hpp"
 
 namespace bgs
 {
@@ -31,13 +33,37 @@ public:
     {
         m_alpha = 0.001f;
         m_max_modes = 3;
+        m_background_interval = 0;
+        m_half_float = false;
         m_low_threshold = 5.0f*5.0f;
         m_high_threshold = 2*m_low_threshold;    // Note: high threshold is used by post-processing
+        m_fixed_point = false;
+        m_compact_interval = 0;
     }
 
     float &Alpha() { return m_alpha; }
     int &MaxModes() { return m_max_modes; }
 
+    // 0 builds the background image from the model when Background() is called. N > 0
+    // rebuilds it every N frames instead and Background() returns the latest one.
+    int &BackgroundInterval() { return m_background_interval; }
+
+    // Keep the model in 16 bits per value (see HalfStorage in GmmEngine.hpp): half the
+    // memory and memory traffic, the arithmetic is still done in float.
+    // Ignored when FixedPoint() is set.
+    bool &HalfFloat() { return m_half_float; }
+
+    // Run the model in 16-bit fixed point (see FixedGmmEngine.hpp). Half the memory and
+    // twice the pixels per SIMD instruction, at the cost of masks that differ slightly
+    // from the float model. LowThreshold() and HighThreshold() must be below 256 (a
+    // distance of 16 standard deviations), otherwise the first frame throws.
+    bool &FixedPoint() { return m_fixed_point; }
+
+    // 0 keeps MaxModes() modes for every pixel. N > 0 only allocates the modes after the
+    // first for pixels that need them (see CompactLayout) and gives back the memory of
+    // pruned modes every N frames. Ignored when FixedPoint() is set.
+    int &CompactInterval() { return m_compact_interval; }
+
     void write(cv::FileStorage& fs) const {} // write serialization
     void read(const cv::FileNode& node){} // read serialization
 
@@ -47,20 +73,18 @@ private:
     float m_alpha;
     // Maximum number of modes (Gaussian components) that will be used per pixel
     int m_max_modes;
+    // Frames between updates of the background image, 0 updates it on demand
+    int m_background_interval;
+    // Store the model in 16 bits per value
+    bool m_half_float;
+    // Use the fixed-point model instead of the float one
+    bool m_fixed_point;
+    // Frames between compactions of the model, 0 keeps all modes of every pixel
+    int m_compact_interval;
 };
 
 class ZivkovicAGMM : public Bgs
 {
-private:
-    struct GMM
-    {
-        float sigma;
-        float muR;
-        float muG;
-        float muB;
-        float weight;
-    };
-
 public:
     ZivkovicAGMM();
     ZivkovicAGMM(const BgsParams& p);
@@ -76,42 +100,38 @@ public:
     }
 
     void Subtract(const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
-    void Update(const cv::Mat& image, const cv::Mat& update_mask);
+    void Update(const cv::Mat& image,  const cv::Mat& update_mask);
 
-    cv::Mat Background() { return m_background; }
+    cv::Mat Background();
 
 private:
+    // Set the constants of the paper on the float, compact and fixed-point models.
+    void ConfigureEngines();
+
     void Initalize(const cv::Mat& image);
-    void SubtractPixel(long posPixel, const cv::Vec3b& pixel, unsigned char* pModesUsed, unsigned char& lowThreshold, unsigned char& highThreshold);
+    void UpdateBackground();
+
+    template<class Engine>
+    void SubtractModel(Engine& gmm, const cv::Mat& image, cv::Mat& low_threshold_mask, cv::Mat& high_threshold_mask);
 
     // User adjustable parameters
     ZivkovicParams m_params;
 
-    // Threshold when the component becomes significant enough to be included into
-    // the background model. It is the TB = 1-cf from the paper. So I use cf=0.1 => TB=0.9
-    // For alpha=0.001 it means that the mode should exist for approximately 105 frames before
-    // it is considered foreground
-    float m_bg_threshold; //1-cf from the paper
+    // Mixture of Gaussians for every pixel, ordered by weight and pruned
+    // with the complexity reduction prior
+    GmmEngine<WeightOrder, ComplexityPrune, StandardMatch, 3> m_gmm;
 
-    // Initial variance for the newly generated components.
-    // It will will influence the speed of adaptation. A good guess should be made.
-    // A simple way is to estimate the typical standard deviation from the images.
-    float m_variance;
+    // The same model with the modes after the first allocated on demand, used instead of
+    // m_gmm if CompactInterval() is set
+    GmmEngine<WeightOrder, ComplexityPrune, StandardMatch, 3, CompactLayout> m_compact_gmm;
 
-    // This is related to the number of samples needed to accept that a component
-    // actually exists.
-    float m_complexity_prior;
-
-    //image
-    int m_num_bands;    //only RGB now ==3
-
-    // dynamic array for the mixture of Gaussians
-    std::vector<GMM> m_modes;
+    // The same model in fixed point, used instead of m_gmm if FixedPoint() is set
+    FixedGmmEngine<3> m_fixed_gmm;
 
+    // Current background model
     cv::Mat m_background;
-
-    //number of Gaussian components per pixel
-    unsigned char* m_modes_per_pixel;
+    // Set when the model changed since m_background was last built
+    bool m_background_dirty;
 };
 
 }
@@ -10,7 +10,9 @@ TARGET = bgs
 TEMPLATE = lib
 #CONFIG += staticlib
 
-LIBS +=`pkg-config opencv --cflags --libs`
+QMAKE_CXXFLAGS += -std=c++11
+
+LIBS +=`pkg-config opencv --cflags --libs` -lpthread
 
 SOURCES += \
     WrenGA.cpp \
@@ -21,7 +23,15 @@ SOURCES += \
     Mean.cpp \
     PratiMediod.cpp \
     ZivkovicGMM.cpp \
-    SimpleFrameDifferencing.cpp
+    SimpleFrameDifferencing.cpp \
+    ThreadPool.cpp \
+    GmmLayout.cpp \
+    SnapshotPca.cpp \
+    ModelFile.cpp \
+    Hysteresis.cpp \
+    BgsStreamGroup.cpp \
+    SyntheticScene.cpp \
+    Simd.cpp
 
 HEADERS += \
     WrenGA.hpp \
@@ -35,7 +45,18 @@ HEADERS += \
     Bgs.hpp \
     ZivkovicGMM.hpp \
     libBGS.h \
-    SimpleFrameDifferencing.hpp
+    SimpleFrameDifferencing.hpp \
+    Simd.hpp \
+    GmmEngine.hpp \
+    GmmLayout.hpp \
+    FixedGmmEngine.hpp \
+    ThreadPool.hpp \
+    SnapshotPca.hpp \
+    ModelFile.hpp \
+    Hysteresis.hpp \
+    BgsStreamGroup.hpp \
+    SpscQueue.hpp \
+    SyntheticScene.hpp
 
 unix:!symbian {
     maemo5 {
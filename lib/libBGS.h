@@ -4,12 +4,15 @@
 #include <AdaptiveMedian.hpp>
 #include <Bgs.hpp>
 #include <BgsParams.hpp>
+#include <BgsStreamGroup.hpp>
 #include <Eigenbackground.hpp>
 #include <GrimsonGMM.hpp>
+#include <Hysteresis.hpp>
 #include <Mean.hpp>
 #include <PoppeGMM.hpp>
 #include <PratiMediod.hpp>
 #include <SimpleFrameDifferencing.hpp>
+#include <SyntheticScene.hpp>
 #include <WrenGA.hpp>
 #include <ZivkovicGMM.hpp>
 
@@ -1,19 +1,116 @@
 #include <iostream>
+#include <atomic>
+#include <exception>
+#include <string>
+#include <thread>
 
 #include <libBGS.h>
+#include <SpscQueue.hpp>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+// The runner is a pipeline of four stages, each on its own thread and connected by bounded
+// queues: capture -> background subtraction -> foreground compositing -> output (video
+// writer and windows, on the main thread since highgui needs it). A stage that falls behind
+// fills the queue in front of it and so holds back the stages before it.
+
+namespace
+{
+
+// a frame on its way through the pipeline, an empty frame marks the end of the video
+struct Packet
+{
+    cv::Mat frame;
+    cv::Mat low_threshold_mask;
+    cv::Mat high_threshold_mask;
+    cv::Mat background;
+    cv::Mat fg_mask;
+    cv::Mat fg_image;
+};
+
+typedef bgs::SpscQueue<Packet> Queue;
+
+// frames a queue can hold before the stage in front of it waits
+const size_t QUEUE_DEPTH = 4;
+
+// set to stop reading the video, by the output stage or by a stage that failed
+std::atomic<bool> stop(false);
+
+void CaptureStage(cv::VideoCapture& capture, Queue& out, std::exception_ptr& error)
+{
+    try
+    {
+        while(!stop)
+        {
+            // a new packet each time, so a frame still in the pipeline is never read into
+            Packet packet;
+            capture >> packet.frame;
+            if(packet.frame.empty())
+                break;
+            out.Push(packet);
+        }
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+        stop = true;
+    }
+
+    Packet end;
+    out.Push(end);
+}
+
+// Pass every packet from 'in' through body() to 'out', followed by the end marker. Once body()
+// throws the remaining packets are dropped, but still taken from 'in' so that the stages in
+// front of this one never wait on a full queue.
+template<class Body>
+void RunStage(Queue& in, Queue& out, std::exception_ptr& error, const Body& body)
+{
+    Packet packet;
+    for(;;)
+    {
+        in.Pop(packet);
+        if(packet.frame.empty())
+            break;
+        if(error)
+            continue;
+
+        try
+        {
+            body(packet);
+            out.Push(packet);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+            stop = true;
+        }
+    }
+
+    out.Push(packet);
+}
+
+}
+
 int main(int argc, char *argv[])
 {
-    if(argc != 3)
+    bool headless = false;
+    int arg = 1;
+    if(arg < argc && std::string(argv[arg]) == "--headless")
     {
-        std::cout << "Usage: " << argv[0] << " <video file, output video>" << std::endl;
+        headless = true;
+        arg++;
+    }
+
+    if(argc - arg != 2)
+    {
+        std::cout << "Usage: " << argv[0] << " [--headless] <video file> <output video>" << std::endl;
+        return 1;
     }
 
-    std::string vid = argv[1];
+    std::string vid = argv[arg];
     std::cout << vid << std::endl;
     cv::VideoCapture capture(vid);
     if (!capture.isOpened())
@@ -24,15 +121,22 @@ int main(int argc, char *argv[])
 
     int width = capture.get(CV_CAP_PROP_FRAME_WIDTH);
     int height = capture.get(CV_CAP_PROP_FRAME_HEIGHT);
-
-    cv::Mat frame, fg_image;
-    cv::Mat low_threshold_mask;
-    cv::Mat high_threshold_mask;
+    double fps = capture.get(CV_CAP_PROP_FPS);
+    if(fps <= 0)
+        fps = 30;
 
     // Video Writer
     cv::VideoWriter writer;
-    std::string out = argv[2];
-    writer.open(out, CV_FOURCC('D','I','V','X'), 30, cv::Size(width,height));
+    std::string out = argv[arg+1];
+    writer.open(out, CV_FOURCC('D','I','V','X'), fps, cv::Size(width,height));
+    if (!writer.isOpened())
+    {
+        std::cerr << "Failed to open output video!\n" << std::endl;
+        return 1;
+    }
+
+    // keep low threshold pixels that are connected to high threshold ones
+    bgs::Hysteresis hysteresis(bgs::Hysteresis::CONNECTED);
 
     // AdaptiveMedian
     //bgs::AdaptiveMedianParams params;
@@ -50,60 +154,124 @@ int main(int argc, char *argv[])
     params.HighThreshold() = 2*params.LowThreshold();
     bgs::GrimsonGMM bgs(params);
 
-    cv::namedWindow("Video"); cvMoveWindow("Video", 500, 100);
-    cv::namedWindow("Background"); cvMoveWindow("Background", 900, 100);
-    cv::namedWindow("Foreground Mask"); cvMoveWindow("Foreground Mask", 500, 400);
-    cv::namedWindow("Foreground Image"); cvMoveWindow("Foreground Image", 900, 400);
+    if(!headless)
+    {
+        cv::namedWindow("Video"); cvMoveWindow("Video", 500, 100);
+        cv::namedWindow("Background"); cvMoveWindow("Background", 900, 100);
+        cv::namedWindow("Foreground Mask"); cvMoveWindow("Foreground Mask", 500, 400);
+        cv::namedWindow("Foreground Image"); cvMoveWindow("Foreground Image", 900, 400);
+    }
+
+    Queue captured(QUEUE_DEPTH), subtracted(QUEUE_DEPTH), composited(QUEUE_DEPTH);
+    std::exception_ptr capture_error, subtract_error, composite_error, output_error;
+
+    std::thread capture_thread(CaptureStage, std::ref(capture), std::ref(captured), std::ref(capture_error));
+
+    // perform background subtraction of each frame
+    std::thread subtract_thread([&]()
+    {
+        RunStage(captured, subtracted, subtract_error, [&](Packet& packet)
+        {
+            // histogram equilization
+            //std::vector<cv::Mat> channels;
+            //cv::split(packet.frame,channels);
+            //cv::equalizeHist(channels[0], channels[0]);
+            //cv::equalizeHist(channels[1], channels[1]);
+            //cv::equalizeHist(channels[2], channels[2]);
+            //cv::merge(channels,packet.frame);
+
+            // perform background subtraction
+            bgs.Subtract(packet.frame, packet.low_threshold_mask, packet.high_threshold_mask);
+
+            // update background subtraction
+            bgs.Update(packet.frame, packet.low_threshold_mask);
+
+            // the model changes with the next frame, and is only built when it is shown
+            if(!headless)
+                packet.background = bgs.Background().clone();
+        });
+    });
+
+    // Create Foreground Image
+    std::thread composite_thread([&]()
+    {
+        RunStage(subtracted, composited, composite_error, [&](Packet& packet)
+        {
+            hysteresis.Apply(packet.low_threshold_mask, packet.high_threshold_mask, packet.fg_mask);
+
+            packet.fg_image = cv::Mat::zeros(packet.frame.size(), packet.frame.type());
+            packet.frame.copyTo(packet.fg_image, packet.fg_mask);
+        });
+    });
 
     // Processing
     int frmCnt = 0;
+    double start = (double)cv::getTickCount();
 
-    // perform background subtraction of each frame
+    Packet packet;
     for(;;)
     {
-        std::cout << "Processing frame #" << frmCnt << std::endl;
-
-        capture >> frame;
-        if(frame.empty())
+        composited.Pop(packet);
+        if(packet.frame.empty())
             break;
+        if(output_error)
+            continue;
 
-        // histogram equilization
-        //std::vector<cv::Mat> channels;
-        //cv::split(frame,channels);
-        //cv::equalizeHist(channels[0], channels[0]);
-        //cv::equalizeHist(channels[1], channels[1]);
-        //cv::equalizeHist(channels[2], channels[2]);
-        //cv::merge(channels,frame);
-
-        // perform background subtraction
-        bgs.Subtract(frame, low_threshold_mask, high_threshold_mask);
-
-        // update background subtraction
-        bgs.Update(frame, low_threshold_mask);
-
-        // Create Foreground Image
-        fg_image.setTo(0);
-        frame.copyTo(fg_image, low_threshold_mask);
-        
-        cv::Mat background = bgs.Background();
-        
-        cv::imshow("Video", frame);
-        cv::imshow("Background", background);
-        cv::imshow("Foreground Mask", low_threshold_mask);
-        cv::imshow("Foreground Image", fg_image);
-        
-        // Video Writer
-        writer << fg_image;
-
-        frmCnt++;
-
-        char key = cv::waitKey(1000./30.);
-        if(key == 'q' || key == 'Q' || key == 27)
-            break;
+        try
+        {
+            // Video Writer
+            writer << packet.fg_image;
+
+            if(!headless)
+            {
+                std::cout << "Processing frame #" << frmCnt << std::endl;
+
+                cv::imshow("Video", packet.frame);
+                cv::imshow("Background", packet.background);
+                cv::imshow("Foreground Mask", packet.fg_mask);
+                cv::imshow("Foreground Image", packet.fg_image);
+
+                char key = cv::waitKey(1);
+                if(key == 'q' || key == 'Q' || key == 27)
+                    stop = true;
+            }
+
+            frmCnt++;
+        }
+        catch(...)
+        {
+            output_error = std::current_exception();
+            stop = true;
+        }
     }
 
+    capture_thread.join();
+    subtract_thread.join();
+    composite_thread.join();
     writer.release();
 
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    std::cout << frmCnt << " frames in " << seconds << " s (" << frmCnt / seconds << " fps)" << std::endl;
+
+    std::exception_ptr errors[] = { capture_error, subtract_error, composite_error, output_error };
+    for(size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); ++i)
+    {
+        if(!errors[i])
+            continue;
+        try
+        {
+            std::rethrow_exception(errors[i]);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "Failed: " << e.what() << std::endl;
+        }
+        catch(...)
+        {
+            std::cerr << "Failed" << std::endl;
+        }
+        return 1;
+    }
+
     return 0;
 }
-
@@ -0,0 +1,325 @@
+/****************************************************************************
+*
+* test_eigenbackground.cpp
+*
+* Purpose: Checks the numerics of Eigenbackground. The eigenspace that
+*          SnapshotPca builds from the Gram matrix of the history has to
+*          match the one cv::PCA computes from the frames, up to the sign
+*          of each eigenvector, and the masks and background built with
+*          SnapshotTraining() have to agree with those built without it.
+*          SubtractBatch() has to give the same masks as Subtract(), and
+*          the eigenspace updated with UpdateInterval() has to stay
+*          orthonormal and follow a drift in illumination better than the
+*          one that is not updated.
+*
+******************************************************************************/
+
+#include <libBGS.h>
+#include <SnapshotPca.hpp>
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const int WIDTH = 160;
+const int HEIGHT = 120;
+const int HISTORY = 20;
+const int DIMS = 6;
+const int TEST_FRAMES = 30;
+
+// largest fraction of mask pixels allowed to differ with and without SnapshotTraining()
+const double MASK_BOUND = 0.001;
+
+// illumination drift of the update test, which is compared from DRIFT_FRAME on
+const float DRIFT = 0.2f;
+const int DRIFT_PERIOD = 200;
+const int DRIFT_FRAME = 50;
+const int UPDATE_FRAMES = 150;
+const int UPDATE_INTERVAL = 2;
+
+// largest deviation of the dot products of the updated eigenvectors from the identity
+const double ORTHONORMAL_BOUND = 1e-4;
+
+int failures = 0;
+
+void Check(bool ok, const std::string& what)
+{
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+    if(!ok)
+        failures++;
+}
+
+bgs::SyntheticSceneParams SceneParams(int channels)
+{
+    bgs::SyntheticSceneParams params;
+    params.Width() = WIDTH;
+    params.Height() = HEIGHT;
+    params.Channels() = channels;
+    params.Seed() = 11;
+    return params;
+}
+
+bgs::EigenbackgroundParams ModelParams(bool snapshot)
+{
+    bgs::EigenbackgroundParams params;
+    params.HistorySize() = HISTORY;
+    params.EmbeddedDim() = DIMS;
+    params.SnapshotTraining() = snapshot;
+    return params;
+}
+
+// largest difference of two Mats of the same size, compared as double
+double MaxDifference(const cv::Mat& a, const cv::Mat& b)
+{
+    cv::Mat a64, b64;
+    a.reshape(1, 1).convertTo(a64, CV_64F);
+    b.reshape(1, 1).convertTo(b64, CV_64F);
+
+    double largest = 0;
+    for(int i = 0; i < a64.cols; ++i)
+        largest = std::max(largest, fabs(a64.at<double>(0, i) - b64.at<double>(0, i)));
+    return largest;
+}
+
+// dot product of two CV_64F rows
+double Dot(const cv::Mat& a, const cv::Mat& b)
+{
+    double sum = 0;
+    for(int i = 0; i < a.cols; ++i)
+        sum += a.at<double>(0, i)*b.at<double>(0, i);
+    return sum;
+}
+
+int Differing(const cv::Mat& a, const cv::Mat& b)
+{
+    int count = 0;
+    for(int r = 0; r < a.rows; ++r)
+    {
+        const unsigned char* pa = a.ptr<unsigned char>(r);
+        const unsigned char* pb = b.ptr<unsigned char>(r);
+        for(int c = 0; c < a.cols; ++c)
+            count += pa[c] != pb[c];
+    }
+    return count;
+}
+
+// The eigenspace of the same frames from SnapshotPca and from cv::PCA. max_components == 0
+// keeps the components that retain 'retained' of the variance.
+void TestSnapshotPca(int channels, int max_components, double retained)
+{
+    const std::string suffix = " (" + std::to_string(channels) + (channels == 1 ? " channel, " : " channels, ") +
+                               (max_components > 0 ? std::to_string(max_components) + " components)" : "retained variance)");
+
+    bgs::SyntheticScene scene(SceneParams(channels));
+    bgs::SnapshotPca snapshot;
+    snapshot.Initalize(HISTORY, WIDTH*HEIGHT*channels);
+    cv::Mat rows, row;
+    cv::Mat frame, truth;
+    for(int f = 0; f < HISTORY; ++f)
+    {
+        scene.Read(frame, truth);
+        snapshot.Add(frame, 1);
+        frame.reshape(1, 1).convertTo(row, CV_64F);
+        rows.push_back(row);
+    }
+
+    cv::PCA expected = max_components > 0 ? cv::PCA(rows, cv::Mat(), CV_PCA_DATA_AS_ROW, max_components)
+                                          : cv::PCA(rows, cv::Mat(), CV_PCA_DATA_AS_ROW, retained);
+    cv::PCA pca;
+    snapshot.Compute(pca, max_components, retained, CV_64F, 1);
+
+    Check(MaxDifference(pca.mean, expected.mean) < 1e-9, "mean of the history" + suffix);
+    Check(pca.eigenvectors.rows == expected.eigenvectors.rows, "number of components" + suffix);
+
+    const int components = std::min(pca.eigenvectors.rows, expected.eigenvectors.rows);
+    const double largest = expected.eigenvalues.at<double>(0);
+    bool values = true;
+    bool vectors = true;
+    for(int k = 0; k < components; ++k)
+    {
+        const double value = expected.eigenvalues.at<double>(k);
+        values = values && fabs(pca.eigenvalues.at<double>(k) - value) <= 1e-6*largest;
+
+        // an eigenvector is only defined up to its sign
+        const double dot = Dot(pca.eigenvectors.row(k), expected.eigenvectors.row(k));
+        vectors = vectors && fabs(fabs(dot) - 1) < 1e-6;
+    }
+    Check(values, "eigenvalues" + suffix);
+    Check(vectors, "eigenvectors up to their sign" + suffix);
+}
+
+// The masks and background of the model with and without SnapshotTraining().
+void TestSnapshotTraining(int channels)
+{
+    const std::string suffix = channels == 1 ? " (1 channel)" : " (3 channels)";
+
+    bgs::Eigenbackground snapshot(ModelParams(true));
+    bgs::Eigenbackground full(ModelParams(false));
+
+    bgs::SyntheticScene scene(SceneParams(channels));
+    cv::Mat frame, truth, low_snapshot, high_snapshot, low_full, high_full;
+    double worst = 0;
+    for(int f = 0; f < HISTORY + TEST_FRAMES; ++f)
+    {
+        scene.Read(frame, truth);
+        snapshot.Subtract(frame, low_snapshot, high_snapshot);
+        full.Subtract(frame, low_full, high_full);
+
+        const int differing = std::max(Differing(low_snapshot, low_full), Differing(high_snapshot, high_full));
+        worst = std::max(worst, differing / (double)(WIDTH*HEIGHT));
+    }
+
+    Check(MaxDifference(snapshot.Background(), full.Background()) <= 1, "background with snapshot training" + suffix);
+    Check(worst < MASK_BOUND, "masks with snapshot training" + suffix);
+}
+
+
+// The masks of SubtractBatch() on batches of 'batch' frames and of Subtract() on each frame.
+// The batches start with the training frames, so both the path through Subtract() and the
+// batched projection are covered.
+void TestSubtractBatch(int channels, int batch)
+{
+    const std::string suffix = " (" + std::to_string(batch) + (batch == 1 ? " frame, " : " frames, ") +
+                               std::to_string(channels) + (channels == 1 ? " channel)" : " channels)");
+
+    bgs::Eigenbackground batched(ModelParams(false));
+    bgs::Eigenbackground single(ModelParams(false));
+
+    bgs::SyntheticScene scene(SceneParams(channels));
+    std::vector<cv::Mat> frames(batch), low_batch, high_batch;
+    cv::Mat truth, low, high;
+    int differing = 0;
+    bool sizes = true;
+    for(int f = 0; f < HISTORY + TEST_FRAMES; f += batch)
+    {
+        for(int i = 0; i < batch; ++i)
+            scene.Read(frames[i], truth);
+        batched.SubtractBatch(frames, low_batch, high_batch);
+
+        sizes = sizes && (int)low_batch.size() == batch && (int)high_batch.size() == batch;
+        for(int i = 0; i < batch && sizes; ++i)
+        {
+            single.Subtract(frames[i], low, high);
+            differing += Differing(low_batch[i], low) + Differing(high_batch[i], high);
+        }
+    }
+
+    Check(sizes, "one pair of masks per frame of the batch" + suffix);
+    Check(sizes && differing == 0, "masks of SubtractBatch() match Subtract()" + suffix);
+}
+
+
+// largest deviation of the dot products of the rows of 'vectors' from the identity
+double OrthonormalError(const cv::Mat& vectors)
+{
+    cv::Mat rows;
+    vectors.convertTo(rows, CV_64F);
+
+    double largest = 0;
+    for(int i = 0; i < rows.rows; ++i)
+        for(int j = 0; j <= i; ++j)
+            largest = std::max(largest, fabs(Dot(rows.row(i), rows.row(j)) - (i == j ? 1 : 0)));
+    return largest;
+}
+
+// count the background pixels of 'truth' and those of them that 'mask' marks as foreground
+void CountFalseForeground(const cv::Mat& mask, const cv::Mat& truth, long& background, long& marked)
+{
+    for(int r = 0; r < truth.rows; ++r)
+    {
+        const unsigned char* pm = mask.ptr<unsigned char>(r);
+        const unsigned char* pt = truth.ptr<unsigned char>(r);
+        for(int c = 0; c < truth.cols; ++c)
+        {
+            if(pt[c] == 0)
+            {
+                background++;
+                marked += pm[c] != 0;
+            }
+        }
+    }
+}
+
+// The eigenspace updated every UPDATE_INTERVAL frames against the one built from the history
+// alone, on a scene whose illumination drifts away from that of the history.
+void TestUpdate(int channels, int precision)
+{
+    const std::string suffix = " (" + std::to_string(channels) + (channels == 1 ? " channel, " : " channels, ") +
+                               (precision == 1 ? "float)" : "double)");
+
+    bgs::SyntheticSceneParams scene_params = SceneParams(channels);
+    scene_params.Drift() = DRIFT;
+    scene_params.DriftPeriod() = DRIFT_PERIOD;
+
+    bgs::EigenbackgroundParams params = ModelParams(false);
+    params.Precision() = precision;
+    bgs::Eigenbackground fixed(params);
+    params.UpdateInterval() = UPDATE_INTERVAL;
+    bgs::Eigenbackground updated(params);
+
+    bgs::SyntheticScene scene(scene_params);
+    cv::Mat frame, truth, low_fixed, high_fixed, low_updated, high_updated;
+    long background = 0, false_fixed = 0, false_updated = 0;
+    double worst = 0;
+    for(int f = 0; f < UPDATE_FRAMES; ++f)
+    {
+        scene.Read(frame, truth);
+        fixed.Subtract(frame, low_fixed, high_fixed);
+        fixed.Update(frame, low_fixed);
+        updated.Subtract(frame, low_updated, high_updated);
+        updated.Update(frame, low_updated);
+
+        if(f >= HISTORY)
+            worst = std::max(worst, OrthonormalError(updated.Eigenvectors()));
+        if(f >= DRIFT_FRAME)
+        {
+            long unused = 0;
+            CountFalseForeground(low_fixed, truth, background, false_fixed);
+            CountFalseForeground(low_updated, truth, unused, false_updated);
+        }
+    }
+
+    Check(worst < ORTHONORMAL_BOUND, "updated eigenvectors stay orthonormal" + suffix);
+    const bool ok = false_updated < false_fixed;
+    if(!ok)
+        failures++;
+    printf("%-8sbackground marked foreground under drift, %.2f%% updated, %.2f%% not%s\n", ok ? "ok" : "FAILED",
+           100.0*false_updated/background, 100.0*false_fixed/background, suffix.c_str());
+}
+
+}
+
+int main()
+{
+    try
+    {
+        for(int channels = 3; channels >= 1; channels -= 2)
+        {
+            TestSnapshotPca(channels, DIMS, 0);
+            TestSnapshotPca(channels, 0, 0.95);
+            TestSnapshotTraining(channels);
+
+            const int batches[] = { 1, 5, 16 };
+            for(int batch : batches)
+                TestSubtractBatch(channels, batch);
+
+            TestUpdate(channels, 2);
+            TestUpdate(channels, 1);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "FAILED  " << e.what() << std::endl;
+        return 1;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/****************************************************************************
+*
+* test_fixedpoint.cpp
+*
+* Purpose: Compares ZivkovicAGMM with FixedPoint() against the float model
+*          on the same seeded SyntheticScene, and checks the fraction of
+*          mask pixels that differ against the bound documented in
+*          FixedGmmEngine.hpp: below 0.1% of the pixels of any frame and
+*          0.03% over the whole sequence. Thresholds the fixed-point model
+*          cannot represent have to be rejected rather than clamped.
+*
+******************************************************************************/
+
+#include <libBGS.h>
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+namespace
+{
+
+const int WIDTH = 640;
+const int HEIGHT = 480;
+const int FRAMES = 200;
+
+// largest fraction of the pixels of a frame, and of all frames, whose masks may differ
+const double FRAME_BOUND = 0.001;
+const double SEQUENCE_BOUND = 0.0003;
+
+const int MODES[] = { 3, 5 };
+const float ALPHAS[] = { 0.001f, 0.01f, 0.05f };
+
+int Differing(const cv::Mat& a, const cv::Mat& b)
+{
+    int count = 0;
+    for(int r = 0; r < a.rows; ++r)
+    {
+        const unsigned char* pa = a.ptr<unsigned char>(r);
+        const unsigned char* pb = b.ptr<unsigned char>(r);
+        for(int c = 0; c < a.cols; ++c)
+            count += pa[c] != pb[c];
+    }
+    return count;
+}
+
+// Returns true if neither bound is exceeded.
+bool Compare(int modes, float alpha)
+{
+    bgs::ZivkovicParams params;
+    params.Alpha() = alpha;
+    params.MaxModes() = modes;
+    bgs::ZivkovicAGMM full(params);
+    params.FixedPoint() = true;
+    bgs::ZivkovicAGMM fixed(params);
+
+    bgs::SyntheticSceneParams scene_params;
+    scene_params.Width() = WIDTH;
+    scene_params.Height() = HEIGHT;
+    scene_params.Frames() = FRAMES;
+    scene_params.Seed() = 7;
+    bgs::SyntheticScene scene(scene_params);
+
+    const double pixels = (double)WIDTH*HEIGHT;
+    double worst = 0;
+    double total = 0;
+    cv::Mat frame, truth;
+    cv::Mat low_full, high_full, low_fixed, high_fixed;
+    while(scene.Read(frame, truth))
+    {
+        full.Subtract(frame, low_full, high_full);
+        full.Update(frame, low_full);
+        fixed.Subtract(frame, low_fixed, high_fixed);
+        fixed.Update(frame, low_fixed);
+
+        const double differing = std::max(Differing(low_full, low_fixed), Differing(high_full, high_fixed)) / pixels;
+        worst = std::max(worst, differing);
+        total += differing;
+    }
+
+    const bool ok = worst < FRAME_BOUND && total/FRAMES < SEQUENCE_BOUND;
+    printf("%-8s modes %d  alpha %-6g worst frame %.4f%%, mean %.4f%%\n", ok ? "ok" : "FAILED",
+           modes, alpha, 100*worst, 100*total/FRAMES);
+    return ok;
+}
+
+// Returns true if the first frame throws for the given thresholds.
+bool Rejected(float low_threshold, float high_threshold)
+{
+    bgs::ZivkovicParams params;
+    params.FixedPoint() = true;
+    params.LowThreshold() = low_threshold;
+    params.HighThreshold() = high_threshold;
+    bgs::ZivkovicAGMM model(params);
+
+    cv::Mat frame = cv::Mat::zeros(HEIGHT/8, WIDTH/8, CV_8UC3);
+    cv::Mat low, high;
+    try
+    {
+        model.Subtract(frame, low, high);
+    }
+    catch(const std::exception&)
+    {
+        return true;
+    }
+    return false;
+}
+
+bool CheckRange()
+{
+    const bool ok = !Rejected(25.0f, 255.0f) && Rejected(16.0f*16.0f, 2*16.0f*16.0f) && Rejected(25.0f, 256.0f);
+    printf("%-8s thresholds of 256 and above rejected\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+}
+
+int main()
+{
+    bool ok = true;
+    try
+    {
+        for(size_t m = 0; m < sizeof(MODES)/sizeof(MODES[0]); ++m)
+            for(size_t a = 0; a < sizeof(ALPHAS)/sizeof(ALPHAS[0]); ++a)
+                ok = Compare(MODES[m], ALPHAS[a]) && ok;
+        ok = CheckRange() && ok;
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "FAILED  " << e.what() << std::endl;
+        return 1;
+    }
+
+    return ok ? 0 : 1;
+}
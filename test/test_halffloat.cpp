@@ -0,0 +1,143 @@
+/****************************************************************************
+*
+* test_halffloat.cpp
+*
+* Purpose: Compares the GMM methods with HalfFloat() storage against the
+*          same methods with float storage. Both run on the same seeded
+*          SyntheticScene, with its noise, drift, multimodal texture and
+*          sprites, and the fraction of mask pixels that differ is checked
+*          against the bound documented in the README: below 0.2% of the
+*          pixels of any frame.
+*
+******************************************************************************/
+
+#include <libBGS.h>
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+
+const int WIDTH = 320;
+const int HEIGHT = 240;
+const int FRAMES = 200;
+
+// largest fraction of the pixels of a frame whose masks may differ
+const double BOUND = 0.002;
+
+template<class Params>
+void SetAlpha(Params& params, float alpha, bool half_float)
+{
+    params.Alpha() = alpha;
+    params.HalfFloat() = half_float;
+}
+
+bgs::Bgs* CreateGrimson(float alpha, bool half_float)
+{
+    bgs::GrimsonParams params;
+    SetAlpha(params, alpha, half_float);
+    return new bgs::GrimsonGMM(params);
+}
+
+bgs::Bgs* CreateZivkovic(float alpha, bool half_float)
+{
+    bgs::ZivkovicParams params;
+    SetAlpha(params, alpha, half_float);
+    return new bgs::ZivkovicAGMM(params);
+}
+
+bgs::Bgs* CreatePoppe(float alpha, bool half_float)
+{
+    bgs::PoppeParams params;
+    SetAlpha(params, alpha, half_float);
+    return new bgs::PoppeGMM(params);
+}
+
+struct Method
+{
+    const char* name;
+    bgs::Bgs* (*create)(float alpha, bool half_float);
+};
+
+const Method METHODS[] =
+{
+    { "GrimsonGMM", CreateGrimson },
+    { "ZivkovicAGMM", CreateZivkovic },
+    { "PoppeGMM", CreatePoppe }
+};
+
+const float ALPHAS[] = { 0.001f, 0.01f };
+
+int Differing(const cv::Mat& a, const cv::Mat& b)
+{
+    int count = 0;
+    for(int r = 0; r < a.rows; ++r)
+    {
+        const unsigned char* pa = a.ptr<unsigned char>(r);
+        const unsigned char* pb = b.ptr<unsigned char>(r);
+        for(int c = 0; c < a.cols; ++c)
+            count += pa[c] != pb[c];
+    }
+    return count;
+}
+
+// Returns true if no frame differs by more than BOUND.
+bool Compare(const Method& method, float alpha)
+{
+    std::unique_ptr<bgs::Bgs> full(method.create(alpha, false));
+    std::unique_ptr<bgs::Bgs> half(method.create(alpha, true));
+
+    bgs::SyntheticSceneParams params;
+    params.Width() = WIDTH;
+    params.Height() = HEIGHT;
+    params.Frames() = FRAMES;
+    params.Seed() = 7;
+    bgs::SyntheticScene scene(params);
+
+    const double pixels = (double)WIDTH*HEIGHT;
+    double worst = 0;
+    double total = 0;
+    cv::Mat frame, truth;
+    cv::Mat low_full, high_full, low_half, high_half;
+    while(scene.Read(frame, truth))
+    {
+        full->Subtract(frame, low_full, high_full);
+        full->Update(frame, low_full);
+        half->Subtract(frame, low_half, high_half);
+        half->Update(frame, low_half);
+
+        const double differing = std::max(Differing(low_full, low_half), Differing(high_full, high_half)) / pixels;
+        worst = std::max(worst, differing);
+        total += differing;
+    }
+
+    const bool ok = worst < BOUND;
+    printf("%-8s %-14s alpha %-6g worst frame %.4f%%, mean %.4f%%\n", ok ? "ok" : "FAILED",
+           method.name, alpha, 100*worst, 100*total/FRAMES);
+    return ok;
+}
+
+}
+
+int main()
+{
+    bool ok = true;
+    try
+    {
+        for(size_t m = 0; m < sizeof(METHODS)/sizeof(METHODS[0]); ++m)
+            for(size_t a = 0; a < sizeof(ALPHAS)/sizeof(ALPHAS[0]); ++a)
+                ok = Compare(METHODS[m], ALPHAS[a]) && ok;
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "FAILED  " << e.what() << std::endl;
+        return 1;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+/****************************************************************************
+*
+* test_model_file.cpp
+*
+* Purpose: Checks the binary Eigenbackground model file. A loaded model has
+*          to classify frames exactly like the one that was saved, also
+*          after it has been saved over the file it is mapped from, and
+*          damaged files have to be rejected with an error rather than
+*          read out of bounds. A loaded model that rebuilds its eigenspace
+*          has to refill its history first.
+*
+******************************************************************************/
+
+#include <libBGS.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+namespace
+{
+
+const int WIDTH = 160;
+const int HEIGHT = 120;
+const int TRAINING_FRAMES = 25;
+const int TEST_FRAMES = 20;
+
+// offsets in the file header of the model
+const long WIDTH_OFFSET = 16;
+const long DIMS_OFFSET = 52;
+
+int failures = 0;
+
+void Check(bool ok, const std::string& what)
+{
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+    if(!ok)
+        failures++;
+}
+
+bool Same(const cv::Mat& a, const cv::Mat& b)
+{
+    if(a.rows != b.rows || a.cols != b.cols || a.type() != b.type())
+        return false;
+    for(int r = 0; r < a.rows; ++r)
+        if(memcmp(a.ptr(r), b.ptr(r), a.cols*a.elemSize()) != 0)
+            return false;
+    return true;
+}
+
+bgs::SyntheticSceneParams SceneParams(int channels)
+{
+    bgs::SyntheticSceneParams params;
+    params.Width() = WIDTH;
+    params.Height() = HEIGHT;
+    params.Channels() = channels;
+    params.Seed() = 15;
+    return params;
+}
+
+// true if both models give the same masks for the frames after training
+bool SameMasks(bgs::Eigenbackground& a, bgs::Eigenbackground& b, int channels)
+{
+    bgs::SyntheticScene scene(SceneParams(channels));
+    scene.Position() = TRAINING_FRAMES;
+
+    cv::Mat frame, truth, low_a, high_a, low_b, high_b;
+    for(int f = 0; f < TEST_FRAMES; ++f)
+    {
+        scene.Read(frame, truth);
+        a.Subtract(frame, low_a, high_a);
+        b.Subtract(frame, low_b, high_b);
+        if(!Same(low_a, low_b) || !Same(high_a, high_b))
+            return false;
+    }
+    return true;
+}
+
+// A loaded model that keeps rebuilding its eigenspace refills its history from the frames after
+// Load(). True if it runs through the refill and the rebuilds that follow.
+bool RebuildsAfterLoad(bgs::EigenbackgroundParams params, const std::string& file, int channels)
+{
+    params.RebuildInterval() = 10;
+    const int frames = params.HistorySize() + 3*params.RebuildInterval();
+
+    try
+    {
+        bgs::Eigenbackground model(params);
+        model.Load(file);
+
+        bgs::SyntheticScene scene(SceneParams(channels));
+        scene.Position() = TRAINING_FRAMES;
+        cv::Mat frame, truth, low, high;
+        for(int f = 0; f < frames; ++f)
+        {
+            scene.Read(frame, truth);
+            model.Subtract(frame, low, high);
+            model.Update(frame, low);
+        }
+        return low.rows == frame.rows && low.cols == frame.cols;
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "        " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool LoadFails(const std::string& file)
+{
+    try
+    {
+        bgs::Eigenbackground model;
+        model.Load(file);
+    }
+    catch(const std::exception&)
+    {
+        return true;
+    }
+    return false;
+}
+
+void Patch(const std::string& file, long offset, const void* data, size_t bytes)
+{
+    FILE* f = fopen(file.c_str(), "r+b");
+    if(!f || fseek(f, offset, SEEK_SET) != 0 || fwrite(data, 1, bytes, f) != bytes)
+        Check(false, "patch " + file);
+    if(f)
+        fclose(f);
+}
+
+void CopyFile(const std::string& from, const std::string& to)
+{
+    FILE* in = fopen(from.c_str(), "rb");
+    FILE* out = fopen(to.c_str(), "wb");
+    char buffer[4096];
+    size_t bytes;
+    while(in && out && (bytes = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, bytes, out);
+    if(in)
+        fclose(in);
+    if(out)
+        fclose(out);
+}
+
+void TestChannels(int channels)
+{
+    const std::string suffix = channels == 1 ? " (1 channel)" : " (3 channels)";
+    const std::string file = "test_model_file.bin";
+    const std::string damaged = "test_model_file_damaged.bin";
+
+    bgs::EigenbackgroundParams params;
+    params.HistorySize() = 20;
+    params.EmbeddedDim() = 6;
+    params.SnapshotTraining() = true;
+
+    bgs::Eigenbackground trained(params);
+    bgs::SyntheticScene scene(SceneParams(channels));
+    cv::Mat frame, truth, low, high;
+    for(int f = 0; f < TRAINING_FRAMES; ++f)
+    {
+        scene.Read(frame, truth);
+        trained.Subtract(frame, low, high);
+    }
+    trained.Save(file);
+
+    bgs::Eigenbackground loaded;
+    loaded.Load(file);
+    Check(Same(trained.Background(), loaded.Background()), "background after load" + suffix);
+    Check(SameMasks(trained, loaded, channels), "masks after load" + suffix);
+
+    // the loaded model points into the mapping of the file it is saved over
+    loaded.Save(file);
+    bgs::Eigenbackground reloaded;
+    reloaded.Load(file);
+    Check(Same(trained.Background(), reloaded.Background()), "background after save over the loaded file" + suffix);
+    Check(SameMasks(trained, reloaded, channels), "masks after save over the loaded file" + suffix);
+    Check(SameMasks(trained, loaded, channels), "model still usable after saving over its file" + suffix);
+
+    Check(RebuildsAfterLoad(params, file, channels), "rebuilds after load" + suffix);
+    params.SnapshotTraining() = false;
+    Check(RebuildsAfterLoad(params, file, channels), "rebuilds after load without snapshot training" + suffix);
+
+    CopyFile(file, damaged);
+    const unsigned char flip = 0x55;
+    Patch(damaged, 4000, &flip, 1);
+    Check(LoadFails(damaged), "changed byte rejected" + suffix);
+
+    CopyFile(file, damaged);
+    if(truncate(damaged.c_str(), 3000) != 0)
+        Check(false, "truncate " + damaged);
+    Check(LoadFails(damaged), "truncated file rejected" + suffix);
+
+    // sizes whose products wrap around or do not fit an int
+    const int32_t huge[3] = { 0x7fffffff, 0x7fffffff, 3 };
+    CopyFile(file, damaged);
+    Patch(damaged, WIDTH_OFFSET, huge, sizeof(huge));
+    Check(LoadFails(damaged), "huge frame size rejected" + suffix);
+
+    const int32_t sizes[2] = { 65536, 65536 };
+    CopyFile(file, damaged);
+    Patch(damaged, WIDTH_OFFSET, sizes, sizeof(sizes));
+    Check(LoadFails(damaged), "frame size beyond the file rejected" + suffix);
+
+    const int32_t dims = 0x7fffffff;
+    CopyFile(file, damaged);
+    Patch(damaged, DIMS_OFFSET, &dims, sizeof(dims));
+    Check(LoadFails(damaged), "huge number of eigenvectors rejected" + suffix);
+
+    remove(file.c_str());
+    remove(damaged.c_str());
+}
+
+}
+
+int main()
+{
+    try
+    {
+        TestChannels(3);
+        TestChannels(1);
+    }
+    catch(const std::exception& e)
+    {
+        std::cout << "FAILED  " << e.what() << std::endl;
+        return 1;
+    }
+
+    return failures == 0 ? 0 : 1;
+}